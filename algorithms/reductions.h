@@ -1,166 +1,135 @@
 #pragma once
 // file: algorithms/reductions.h
-// description: implements column and row echelonizers for smatrix
+// description: implements the column reduction with clearing used to compute
+//              homology bases with smatrix
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
 
 #include "../smatrix.h"
 
 namespace cubitos {
 
-/* Algorithms based on
- * https://www.jeremykun.com/2013/04/10/computing-homology/
+/* Standard persistence column reduction with the clearing (twist)
+ * optimization, based on
+ * C. Chen, M. Kerber. Persistent homology computation with a twist (2011)
  */
 
-template <
-    size_t _N, 
-    bool _EnableComplementary
->
-inline void 
-rowReduce(SMatrix<_N>& A,
-        SMatrix<_N>* B,
-        SMatrix<_N>& P,
-        SMatrix<_N>& P_inv,
-        size_t& i
-        ) {
-    auto& field = SMatrix<_N>::field_;
-
-    size_t numRows = A.n_, numCols = A.m_;
-
-    /* Row echelonizes A into P A */
-    for (size_t j = 0; i < numRows && j < numCols;) {
-        size_t nonzeroRow = i;
-        for (; nonzeroRow < numRows && field.isZero(A.get(nonzeroRow, j));
-             nonzeroRow++);
-        if (nonzeroRow == numRows) {
-            j++;
-            continue;
-        } else if (nonzeroRow != i) {
-            A.rowSwap(i, nonzeroRow);
-            P.rowSwap(i, nonzeroRow);
-            if constexpr (_EnableComplementary) {
-                B->colSwap(i, nonzeroRow);
-            }
-            P_inv.colSwap(i, nonzeroRow);
-        }
+// Marks a simplex which is not the low of any column
+static const size_t NO_COLUMN = SIZE_MAX;
 
-        Element pivot = A.get(i, j);
-        field.invin(pivot);
-        field.negin(pivot);
-        for (size_t otherRow = i + 1; otherRow < numRows; otherRow++) {
-            Element c = A.get(otherRow, j);
-            if (!field.isZero(c)) {
-                field.mulin(c, pivot);
-                A.rowCombine(otherRow, i, c);
-                P.rowCombine(otherRow, i, c);
-                field.negin(c);
-                P_inv.colCombine(i, otherRow, c);
-                // If we have set a complementary matrix
-                if constexpr (_EnableComplementary) {
-                    B->colCombine(i, otherRow, c);
-                }
-            }
-        }
-
-        i++; j++;
-    }
+// Returns the c such that a + c * b = 0
+// Pre: b != 0
+template <size_t _N>
+inline typename SMatrix<_N>::Element cancelFactor(
+    const typename SMatrix<_N>::Element& a,
+    const typename SMatrix<_N>::Element& b) {
+    const auto& field = SMatrix<_N>::field();
+    typename SMatrix<_N>::Element c = b;
+    field.invin(c);
+    field.mulin(c, a);
+    field.negin(c);
+    return c;
 }
 
-template <
-    size_t _N, 
-    bool _EnableComplementary
->
-inline void 
-columnReduce(SMatrix<_N>& A, 
-        SMatrix<_N>* B, 
-        SMatrix<_N>& Q, 
-        SMatrix<_N>& Q_inv,
-        size_t& j
-        ) {
-    auto& field = SMatrix<_N>::field_;
-    size_t numRows = A.n_, numCols = A.m_;
-
-    /* Column echelonizes A into A Q */
-    for (size_t i = 0; i < numRows && j < numCols;) {
-        size_t nonzeroCol = j;
-        for (; nonzeroCol < numCols && field.isZero(A.get(i, nonzeroCol));
-             nonzeroCol++);
+// Over Z/2 every nonzero entry is 1 = -1
+template <>
+inline SMatrix<2>::Element cancelFactor<2>(const SMatrix<2>::Element&,
+                                           const SMatrix<2>::Element&) {
+    return true;
+}
 
-        if (nonzeroCol == numCols) {
-            i++;
+// Basis of the k-cycles of a complex, split into the reduced boundaries of
+// d_{k+1} (zero in homology) and the essential cycles (a basis of the
+// homology group H_k). All of them have a different low, so any k-cycle is
+// written in this basis eliminating its lows.
+template <size_t _N>
+struct HomologyBasis {
+    // Reduced d_{k+1} and, for each k-simplex, the column of boundaries
+    // whose low it is or NO_COLUMN
+    SMatrix<_N> boundaries;
+    std::vector<size_t> boundaryWithLow;
+    // Essential cycles, sorted by their low, and for each k-simplex the
+    // cycle whose low it is or NO_COLUMN
+    SMatrix<_N> cycles;
+    std::vector<size_t> cycleWithLow;
+};
+
+// Column reduces the boundary matrix A = d_k left to right, so that no two
+// nonzero columns share their low. The columns in clear (k-simplices that are
+// the low of a reduced column of d_{k+1}) would reduce to zero, so they are
+// cleared without any work. The column operations are also applied to V, and
+// V_j is a cycle whenever column j ends up zero.
+// Returns the low of every column of A, or NO_COLUMN if it is zero.
+template <size_t _N>
+std::vector<size_t> reduceBoundary(SMatrix<_N>& A, SMatrix<_N>& V,
+                                   const std::vector<bool>& clear) {
+    size_t numRows = A.rowdim(), numCols = A.coldim();
+    std::vector<size_t> lows(numCols, NO_COLUMN);
+    std::vector<size_t> pivotCol(numRows, NO_COLUMN);
+
+    for (size_t j = 0; j < numCols; j++) {
+        if (clear[j]) {
+            A.scaleCol(j, 0);
             continue;
-        } else if (nonzeroCol != j) {
-            A.colSwap(j, nonzeroCol);
-            Q.colSwap(j, nonzeroCol);
-            if constexpr (_EnableComplementary) {
-                B->rowSwap(j, nonzeroCol);
-            }
-            Q_inv.rowSwap(j, nonzeroCol);
         }
-
-        Element pivot = A.get(i, j);
-        field.invin(pivot);
-        field.negin(pivot);
-        for (size_t otherCol = j + 1; otherCol < numCols; otherCol++) {
-            Element c = A.get(i, otherCol);
-            if (!field.isZero(c)) {
-                field.mulin(c, pivot);
-                A.colCombine(otherCol, j, c);
-                Q.colCombine(otherCol, j, c);
-                field.negin(c);
-                // If we have set a complementary matrix
-                if constexpr (_EnableComplementary) {
-                    B->rowCombine(j, otherCol, c);
-                }
-                Q_inv.rowCombine(j, otherCol, c);
-            }
+        size_t low = A.low(j);
+        while (low < numRows && pivotCol[low] != NO_COLUMN) {
+            size_t i = pivotCol[low];
+            auto c = cancelFactor<_N>(A.get(low, j), A.get(low, i));
+            A.colCombine(j, i, c);
+            V.colCombine(j, i, c);
+            low = A.low(j);
+        }
+        if (low < numRows) {
+            pivotCol[low] = j;
+            lows[j] = low;
         }
-
-        i++; j++;
     }
+    return lows;
 }
 
+// Fills the essential cycles of basis with the given columns of V
+// Pre: every essential column j of V has its low at j
 template <size_t _N>
-inline void 
-columnReduce(SMatrix<_N>& A, 
-        SMatrix<_N>& Q, 
-        SMatrix<_N>& Q_inv,
-        size_t& firstHomologyIndex
-        ) {
-    Q = SMatrix<_N>::identity(A.m_);
-    Q_inv = SMatrix<_N>::identity(A.m_);
-    firstHomologyIndex = 0;
-    columnReduce<_N, false>(A, nullptr, Q, Q_inv, firstHomologyIndex);
-}
-
-template <size_t _N>
-inline void 
-rowReduce(SMatrix<_N>& A, 
-        SMatrix<_N>& P, 
-        SMatrix<_N>& P_inv,
-        size_t& firstHomologyIndex
-        ) {
-    P = SMatrix<_N>::identity(A.n_);
-    P_inv = SMatrix<_N>::identity(A.n_);
-    firstHomologyIndex = 0;
-    rowReduce<_N, false>(A, nullptr, P, P_inv, firstHomologyIndex);
+void setEssentialCycles(HomologyBasis<_N>& basis, const SMatrix<_N>& V,
+                        const std::vector<size_t>& essential) {
+    basis.cycles = V.selectCols(essential);
+    basis.cycleWithLow.assign(V.coldim(), NO_COLUMN);
+    for (size_t e = 0; e < essential.size(); e++) {
+        basis.cycleWithLow[essential[e]] = e;
+    }
 }
 
+// Writes every column of Y, which must be k-cycles, in the basis and returns
+// the coordinates of their homology classes in the essential cycles.
+// Y is consumed in the process.
 template <size_t _N>
-inline void 
-simultaneousReduce(SMatrix<_N>& A, 
-        SMatrix<_N>& B, 
-        SMatrix<_N>& R,
-        SMatrix<_N>& R_inv,
-        size_t& firstHomologyIndex
-        ) {
-    assert(A.m_ == B.n_);
-
-    R = SMatrix<_N>::identity(A.m_);
-    R_inv = SMatrix<_N>::identity(A.m_);
-
-    firstHomologyIndex = 0;
-
-    columnReduce<_N, true>(A, &B, R, R_inv, firstHomologyIndex);
-    rowReduce<_N, true>(B, &A, R_inv, R, firstHomologyIndex);
+SMatrix<_N> homologyCoordinates(SMatrix<_N>& Y,
+                                const HomologyBasis<_N>& basis) {
+    size_t numRows = Y.rowdim();
+    SMatrix<_N> X(basis.cycles.coldim(), Y.coldim());
+
+    for (size_t j = 0; j < Y.coldim(); j++) {
+        for (size_t low = Y.low(j); low < numRows; low = Y.low(j)) {
+            size_t b = basis.boundaryWithLow[low];
+            if (b != NO_COLUMN) {
+                Y.colCombine(j, basis.boundaries, b,
+                             cancelFactor<_N>(Y.get(low, j),
+                                              basis.boundaries.get(low, b)));
+                continue;
+            }
+            size_t e = basis.cycleWithLow[low];
+            assert(e != NO_COLUMN);
+            // Essential cycles have a 1 at their low
+            X.insert(e, j, Y.get(low, j));
+            Y.colCombine(
+                j, basis.cycles, e,
+                cancelFactor<_N>(Y.get(low, j), basis.cycles.get(low, e)));
+        }
+    }
+    return X;
 }
 
 }  // namespace cubitos
@@ -2,95 +2,321 @@
 // file: ccomplex.cc
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstdint>
+
+#include "parallel.h"
 
 using namespace cubitos;
 
-CComplex::CComplex() : dim_(0), depth_(0) {}
-CComplex::CComplex(const size_t depth, Region* region)
-    : dim_(0), depth_(depth), region_(region) {
+const size_t AbstractComplex::NO_PARENT;
+
+// Parents expanded by a thread at least
+static const size_t MIN_PARENTS_PER_CHUNK = 256;
+
+template <size_t D, class T>
+CComplex<D, T>::CComplex() {}
+template <size_t D, class T>
+CComplex<D, T>::CComplex(const size_t depth, const Region<D, T>* region)
+    : AbstractComplex(depth), region_(region) {
     // We create the vector for the 0-simplices
-    std::vector<CSimplex> vector;
+    std::vector<CSimplex<D, T>> vector;
     simplices_.push_back(vector);
+    collapsingMaps_.emplace_back();
+    index_.emplace_back();
 }
 
-void CComplex::add(const CSimplex& csimplex) {
-    while (dim_ < csimplex.dim_) {
-        std::vector<CSimplex> vector;
+template <size_t D, class T>
+size_t CComplex<D, T>::add(const CSimplex<D, T>& csimplex) {
+    while (dim_ < csimplex.dim()) {
+        std::vector<CSimplex<D, T>> vector;
         simplices_.push_back(vector);
+        collapsingMaps_.emplace_back();
+        index_.emplace_back();
         dim_++;
     }
-    simplices_[csimplex.dim_].push_back(csimplex);
+    size_t pos = simplices_[csimplex.dim()].size();
+    index_[csimplex.dim()][csimplex.center()] = pos;
+    simplices_[csimplex.dim()].push_back(csimplex);
+    collapsingMaps_[csimplex.dim()].push_back(NO_PARENT);
+    return pos;
 }
 
-size_t CComplex::numSimplicesIn(size_t dim) const {
+template <size_t D, class T>
+size_t CComplex<D, T>::numSimplicesIn(size_t dim) const {
     if (dim > dim_) {
         return 0;
     }
     return simplices_[dim].size();
 }
 
-CComplex CComplex::expand() const {
-    CComplex expanded_complex(depth_ + 1, region_);
+template <size_t D, class T>
+size_t CComplex<D, T>::indexOf(const CSimplex<D, T>& csimplex) const {
+    if (csimplex.dim() > dim_) {
+        return numSimplicesIn(csimplex.dim());
+    }
+    auto it = index_[csimplex.dim()].find(csimplex.center());
+    if (it == index_[csimplex.dim()].end()) {
+        return simplices_[csimplex.dim()].size();
+    }
+    return it->second;
+}
+
+template <size_t D, class T>
+CComplex<D, T> CComplex<D, T>::expand() const {
+    CComplex<D, T> expanded_complex(depth_ + 1, region_);
+    // The vertices of the expansions are centers of depth depth_ + 2, they
+    // are all looked up in cells of that depth
+    OccupancyCache<D, T> occupied(*region_, depth_ + 2);
+
+    // Every parent is expanded independently, so the parents of all levels
+    // are split into chunks expanded concurrently
+    std::vector<std::pair<size_t, size_t>> parents;
     for (size_t level = 0; level < simplices_.size(); level++) {
-        std::map<CSimplex, size_t> temp_collapsing;
-        std::map<size_t, size_t> final_collapsing;
         for (size_t i = 0; i < simplices_[level].size(); i++) {
-            // For the ones of the same size, we save where they came from
-            auto simplex = simplices_[level][i];
-            for (auto exp : simplex.expansions(*region_)) {
-                expanded_complex.add(exp);
-                if (exp.dim_ == simplex.dim_) {
-                    temp_collapsing[exp] = i;
+            parents.push_back({level, i});
+        }
+    }
+    size_t numChunks = chunksFor(parents.size(), MIN_PARENTS_PER_CHUNK);
+    std::vector<std::vector<CSimplex<D, T>>> children(numChunks);
+    std::vector<std::vector<size_t>> numChildren(numChunks);
+    parallelChunks(parents.size(), numChunks,
+                   [&](size_t chunk, size_t begin, size_t end) {
+                       for (size_t p = begin; p < end; p++) {
+                           const auto& simplex =
+                               simplices_[parents[p].first][parents[p].second];
+                           numChildren[chunk].push_back(
+                               simplex.expansions(occupied, children[chunk]));
+                       }
+                   });
+
+    // Children are added in the order of their parents, as if they were
+    // expanded one after the other
+    auto parent = parents.begin();
+    for (size_t chunk = 0; chunk < numChunks; chunk++) {
+        auto exp = children[chunk].begin();
+        for (size_t count : numChildren[chunk]) {
+            size_t level = parent->first, i = parent->second;
+            for (; count > 0; count--, exp++) {
+                size_t pos = expanded_complex.add(*exp);
+                // For the ones of the same size, we save where they came from
+                if (exp->dim() == level) {
+                    expanded_complex.collapsingMaps_[level][pos] = i;
+                }
+            }
+            parent++;
+        }
+    }
+    return expanded_complex;
+}
+
+template <size_t D, class T>
+void CComplex<D, T>::collapse() {
+    // faces[dim]: faces of each dim-simplex, as the columns of d_dim
+    // cofaces[dim]: cofaces of each dim-simplex, as the rows of d_{dim+1},
+    // in the same compressed format
+    std::vector<SparseMap>& faces = diffMaps_;
+    faces.assign(dim_ + 1, SparseMap());
+    for (size_t dim = 1; dim <= dim_; dim++) {
+        faces[dim] = computeDifferentialMap(dim);
+    }
+    std::vector<SparseMap> cofaces(dim_ + 1);
+    std::vector<std::vector<size_t>> numCofaces(dim_ + 1);
+    for (size_t dim = 0; dim <= dim_; dim++) {
+        auto& start = cofaces[dim].colStart;
+        start.assign(simplices_[dim].size() + 1, 0);
+        if (dim < dim_) {
+            for (size_t row : faces[dim + 1].rows) {
+                start[row + 1]++;
+            }
+        }
+        for (size_t i = 0; i < simplices_[dim].size(); i++) {
+            numCofaces[dim].push_back(start[i + 1]);
+            start[i + 1] += start[i];
+        }
+        if (dim < dim_) {
+            // Filling a row moves its start to the next one, so the starts
+            // are shifted back afterwards
+            cofaces[dim].rows.resize(start.back());
+            for (size_t c = 0; c < simplices_[dim + 1].size(); c++) {
+                for (size_t k = faces[dim + 1].colStart[c];
+                     k < faces[dim + 1].colStart[c + 1]; k++) {
+                    cofaces[dim].rows[start[faces[dim + 1].rows[k]]++] = c;
                 }
             }
+            for (size_t i = simplices_[dim].size(); i > 0; i--) {
+                start[i] = start[i - 1];
+            }
+            start[0] = 0;
         }
-        // We only create the collapsing map if there are any simplices of the
-        // same size
-        if (level < expanded_complex.simplices_.size()) {
-            for (auto& image : temp_collapsing) {
-                size_t pos = std::distance(
-                    expanded_complex.simplices_[level].begin(),
-                    std::find(expanded_complex.simplices_[level].begin(),
-                              expanded_complex.simplices_[level].end(),
-                              image.first));
-                final_collapsing[pos] = image.second;
+    }
+
+    // Order in which every simplex is collapsed, critical ones are never
+    const size_t CRITICAL = SIZE_MAX;
+    std::vector<std::vector<size_t>> order(dim_ + 1);
+    std::vector<std::pair<size_t, size_t>> freeFaces;
+    for (size_t dim = 0; dim <= dim_; dim++) {
+        order[dim].resize(simplices_[dim].size(), CRITICAL);
+        for (size_t i = 0; i < simplices_[dim].size(); i++) {
+            if (numCofaces[dim][i] == 1) {
+                freeFaces.push_back({dim, i});
             }
-            expanded_complex.collapsingMaps_.push_back(final_collapsing);
         }
     }
-    return expanded_complex;
+
+    size_t numCollapses = 0;
+    while (!freeFaces.empty()) {
+        size_t dim = freeFaces.back().first, face = freeFaces.back().second;
+        freeFaces.pop_back();
+        if (order[dim][face] != CRITICAL || numCofaces[dim][face] != 1) {
+            continue;
+        }
+        const auto& faceCofaces = cofaces[dim];
+        size_t coface = *std::find_if(
+            faceCofaces.rows.begin() + faceCofaces.colStart[face],
+            faceCofaces.rows.begin() + faceCofaces.colStart[face + 1],
+            [&](size_t c) { return order[dim + 1][c] == CRITICAL; });
+        order[dim][face] = order[dim + 1][coface] = numCollapses++;
+
+        // The other faces of coface and the faces of face lose a coface
+        const auto& cofaceFaces = faces[dim + 1];
+        for (size_t k = cofaceFaces.colStart[coface];
+             k < cofaceFaces.colStart[coface + 1]; k++) {
+            size_t other = cofaceFaces.rows[k];
+            if (order[dim][other] == CRITICAL &&
+                --numCofaces[dim][other] == 1) {
+                freeFaces.push_back({dim, other});
+            }
+        }
+        if (dim > 0) {
+            const auto& faceFaces = faces[dim];
+            for (size_t k = faceFaces.colStart[face];
+                 k < faceFaces.colStart[face + 1]; k++) {
+                size_t other = faceFaces.rows[k];
+                if (--numCofaces[dim - 1][other] == 1) {
+                    freeFaces.push_back({dim - 1, other});
+                }
+            }
+        }
+    }
+
+    // Critical simplices first, keeping their order, then the collapsed
+    // ones from the last collapse to the first
+    std::vector<std::vector<size_t>> position(dim_ + 1);
+    std::vector<std::vector<size_t>> oldPosition(dim_ + 1);
+    for (size_t dim = 0; dim <= dim_; dim++) {
+        std::vector<size_t>& sorted = oldPosition[dim];
+        sorted.resize(simplices_[dim].size());
+        for (size_t i = 0; i < sorted.size(); i++) {
+            sorted[i] = i;
+        }
+        const auto& dimOrder = order[dim];
+        std::stable_sort(sorted.begin(), sorted.end(),
+                         [&](size_t i, size_t j) {
+                             bool criticalI = dimOrder[i] == CRITICAL;
+                             bool criticalJ = dimOrder[j] == CRITICAL;
+                             if (criticalI || criticalJ) {
+                                 return criticalI && !criticalJ;
+                             }
+                             return dimOrder[i] > dimOrder[j];
+                         });
+
+        std::vector<CSimplex<D, T>> simplices;
+        position[dim].resize(sorted.size());
+        for (size_t i = 0; i < sorted.size(); i++) {
+            simplices.push_back(simplices_[dim][sorted[i]]);
+            index_[dim][simplices.back().center()] = i;
+            position[dim][sorted[i]] = i;
+        }
+        simplices_[dim].swap(simplices);
+
+        std::vector<size_t> collapsing(sorted.size());
+        for (size_t i = 0; i < sorted.size(); i++) {
+            collapsing[i] = collapsingMaps_[dim][sorted[i]];
+        }
+        collapsingMaps_[dim].swap(collapsing);
+    }
+
+    // The boundaries get the same renumbering, which is cheaper than looking
+    // up all the faces again
+    std::vector<std::pair<size_t, int>> column;
+    for (size_t dim = 1; dim <= dim_; dim++) {
+        const SparseMap& old = faces[dim];
+        SparseMap renumbered;
+        renumbered.colStart.reserve(old.colStart.size());
+        renumbered.colStart.push_back(0);
+        renumbered.rows.reserve(old.rows.size());
+        renumbered.values.reserve(old.values.size());
+        for (size_t j : oldPosition[dim]) {
+            for (size_t k = old.colStart[j]; k < old.colStart[j + 1]; k++) {
+                column.push_back(
+                    {position[dim - 1][old.rows[k]], old.values[k]});
+            }
+            std::sort(column.begin(), column.end());
+            for (auto& entry : column) {
+                renumbered.rows.push_back(entry.first);
+                renumbered.values.push_back(entry.second);
+            }
+            renumbered.colStart.push_back(renumbered.rows.size());
+            column.clear();
+        }
+        faces[dim] = std::move(renumbered);
+    }
+}
+
+template <size_t D, class T>
+const SparseMap& CComplex<D, T>::getDifferentialMap(size_t dim) const {
+    assert(dim > 0 && dim < diffMaps_.size());
+    return diffMaps_[dim];
 }
 
-const std::map<std::pair<size_t, size_t>, int> CComplex::getDifferentialMap(
-    size_t dim) const {
+template <size_t D, class T>
+SparseMap CComplex<D, T>::computeDifferentialMap(size_t dim) const {
     assert(dim > 0);
 
-    std::map<std::pair<size_t, size_t>, int> diffMap;
+    SparseMap diffMap;
+    diffMap.colStart.reserve(simplices_[dim].size() + 1);
+    diffMap.colStart.push_back(0);
+    std::vector<std::pair<size_t, int>> column;
+    std::array<CSimplex<D, T>, 2 * D> faces;
+    std::array<int, 2 * D> coefficients;
 
-    for (size_t i = 0; i < simplices_[dim].size(); i++) {
-        for (auto& item : simplices_[dim][i].differential().simplices) {
-            for (size_t j = 0; j < simplices_[dim - 1].size(); j++) {
-                if (item.first == simplices_[dim - 1][j]) {
-                    diffMap[{i, j}] = item.second;
-                }
+    for (const auto& simplex : simplices_[dim]) {
+        // Each face is looked up in the index, faces out of the complex are
+        // skipped
+        size_t numFaces = simplex.boundary(faces.data(), coefficients.data());
+        for (size_t f = 0; f < numFaces; f++) {
+            size_t j = indexOf(faces[f]);
+            if (j < simplices_[dim - 1].size()) {
+                column.push_back({j, coefficients[f]});
             }
         }
+        std::sort(column.begin(), column.end());
+        for (auto& entry : column) {
+            diffMap.rows.push_back(entry.first);
+            diffMap.values.push_back(entry.second);
+        }
+        diffMap.colStart.push_back(diffMap.rows.size());
+        column.clear();
     }
 
     return diffMap;
 }
 
-const std::map<size_t, size_t>& CComplex::getCollapsingMap(size_t dim) const {
-    static std::map<size_t, size_t> empty_map;
-    if (collapsingMaps_.size() < dim + 1) {
+template <size_t D, class T>
+const std::vector<size_t>& CComplex<D, T>::getCollapsingMap(size_t dim) const {
+    static std::vector<size_t> empty_map;
+    if (dim > dim_) {
         return empty_map;
     }
     return collapsingMaps_[dim];
 }
 
 #ifdef DEBUG
-std::ostream& cubitos::operator<<(std::ostream& out, const CComplex& complex) {
+template <size_t D, class T>
+std::ostream& cubitos::operator<<(std::ostream& out,
+                                  const CComplex<D, T>& complex) {
     out << "CComplex of dim = " << complex.dim_ << " and depth "
         << complex.depth_ << " with simplexes: [" << std::endl;
     for (auto x : complex.simplices_) {
@@ -103,3 +329,16 @@ std::ostream& cubitos::operator<<(std::ostream& out, const CComplex& complex) {
     return out;
 }
 #endif  // DEBUG
+
+#ifdef DEBUG
+#define INSTANTIATE_CCOMPLEX_DEBUG(D, T)                      \
+    template std::ostream& cubitos::operator<<(std::ostream&, \
+                                               const CComplex<D, T>&);
+#else
+#define INSTANTIATE_CCOMPLEX_DEBUG(D, T)
+#endif  // DEBUG
+#define INSTANTIATE_CCOMPLEX(D, T)          \
+    template class cubitos::CComplex<D, T>; \
+    INSTANTIATE_CCOMPLEX_DEBUG(D, T)
+#define INSTANTIATE_CCOMPLEXES(T) FOR_EACH_DIM(INSTANTIATE_CCOMPLEX, T)
+FOR_EACH_COOR(INSTANTIATE_CCOMPLEXES)
@@ -4,6 +4,8 @@
 //              function to generate another complex of greater depth
 
 #include <algorithm>
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
 
 #include "config.h"
@@ -11,49 +13,106 @@
 
 namespace cubitos {
 
-class CComplex {
+// Sparse matrix in compressed column format: the nonzero entries of column
+// j are in rows[colStart[j]..colStart[j + 1]), sorted by row, with the
+// values in the same positions of values
+struct SparseMap {
+    std::vector<size_t> colStart;
+    std::vector<size_t> rows;
+    std::vector<int> values;
+};
+
+// Dimension independent interface of a cubical complex, what persistent
+// modules read from it
+class AbstractComplex {
+   public:
+    AbstractComplex() : dim_(0), depth_(0) {}
+    AbstractComplex(size_t depth) : dim_(0), depth_(depth) {}
+    virtual ~AbstractComplex() {}
+
+    // Returns the number of simplices in each dimension (0 if empty)
+    virtual size_t numSimplicesIn(size_t dim) const = 0;
+
+    // Returns the dim-boundary matrix, the column of each dim-simplex has
+    // its faces as rows with value 1 or -1
+    virtual const SparseMap& getDifferentialMap(size_t dim) const = 0;
+
+    // Returns the dim-collapsing matrix as an array: the i-th dim-simplex
+    // collapses into the j-th dim-simplex of the previous depth, with a 1
+    // value, or j is NO_PARENT
+    virtual const std::vector<size_t>& getCollapsingMap(size_t dim) const = 0;
+
+    // Marks the simplices that do not collapse into a simplex of their
+    // dimension
+    static const size_t NO_PARENT = SIZE_MAX;
+
+    size_t dim_;
+    size_t depth_;
+};
+
+template <size_t D, class T>
+class CComplex : public AbstractComplex {
    public:
     // Empty constructor
     CComplex();
     // Creates a cubical complex of <depth> depth and links it to <region>
     // Pre: <region> points to a valid memory address
-    CComplex(const size_t depth, Region* region);
+    CComplex(const size_t depth, const Region<D, T>* region);
 
-    // Adds a cubical simplex to the complex
-    void add(const CSimplex& csimplex);
+    // Adds a cubical simplex to the complex and returns its position in its
+    // dimension
+    size_t add(const CSimplex<D, T>& csimplex);
 
-    // Returns the number of simplices in each dimension (0 if empty)
-    size_t numSimplicesIn(size_t dim) const;
+    size_t numSimplicesIn(size_t dim) const override;
 
     // Returns an expanded complex of depth+1
-    CComplex expand() const;
+    CComplex<D, T> expand() const;
+
+    // Collapses free faces (faces with a unique coface) together with their
+    // coface while possible. The simplices left, the critical ones, form a
+    // subcomplex with the same homology. Simplices are renumbered so that
+    // the critical ones come first and the rest in the reverse order they
+    // were collapsed, then in every boundary d_dim
+    //  - the boundary of a critical simplex only has critical faces
+    //  - the boundary of a collapsed coface has its free face as last row
+    // The boundaries are kept for getDifferentialMap, so the complex must
+    // not be modified afterwards.
+    void collapse();
 
-    // Returns the dim-boundary matrix as a map
-    //     key: (i,j), value: 1 or -1
-    const std::map<std::pair<size_t, size_t>, int> getDifferentialMap(
-        size_t dim) const;
+    // Returns the position of csimplex (of the depth of the complex) in its
+    // dimension, or the number of simplices in it if it is not in the
+    // complex
+    size_t indexOf(const CSimplex<D, T>& csimplex) const;
 
-    // Returns the dim-collapsing matrix as a map
-    //     key: (i), value: j and a 1 value is assumed for each existing
-    //         pair
-    const std::map<size_t, size_t>& getCollapsingMap(size_t dim) const;
+    // Pre: the complex has been collapsed and 0 < dim <= dim_
+    const SparseMap& getDifferentialMap(size_t dim) const override;
+
+    const std::vector<size_t>& getCollapsingMap(size_t dim) const override;
 
 #ifdef DEBUG
+    template <size_t E, class U>
     friend std::ostream& operator<<(std::ostream& out,
-                                    const CComplex& complex);
+                                    const CComplex<E, U>& complex);
 #endif  // DEBUG
 
-    size_t dim_;
-    size_t depth_;
-
    private:
-    std::vector<std::vector<CSimplex>> simplices_;
-    std::vector<std::map<size_t, size_t>> collapsingMaps_;
-    Region* region_;
+    // Builds d_dim looking up the faces of every dim-simplex in the index
+    SparseMap computeDifferentialMap(size_t dim) const;
+
+    std::vector<std::vector<CSimplex<D, T>>> simplices_;
+    // Parent of each simplex in the previous depth, parallel to simplices_
+    std::vector<std::vector<size_t>> collapsingMaps_;
+    // Position of each simplex in simplices_, by center
+    std::vector<std::unordered_map<Point<D, T>, size_t, PointHash<D, T>>>
+        index_;
+    // d_dim of the collapsed complex, computed once for every module
+    std::vector<SparseMap> diffMaps_;
+    const Region<D, T>* region_;
 };
 
 #ifdef DEBUG
-std::ostream& operator<<(std::ostream& out, const CComplex& complex);
+template <size_t D, class T>
+std::ostream& operator<<(std::ostream& out, const CComplex<D, T>& complex);
 #endif  // DEBUG
 
 }  // namespace cubitos
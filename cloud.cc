@@ -0,0 +1,350 @@
+#include "cloud.h"
+// file: cloud.cc
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#include "parallel.h"
+
+using namespace cubitos;
+
+// Bytes parsed or converted by a thread at least
+static const size_t MIN_BYTES_PER_CHUNK = 1 << 20;
+
+// First bytes of a .npy file, followed by its version
+static const char NPY_MAGIC[] = "\x93NUMPY";
+static const size_t NPY_MAGIC_SIZE = sizeof(NPY_MAGIC) - 1;
+// The data of a .npy file starts at a multiple of this
+static const size_t NPY_ALIGNMENT = 64;
+
+static inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Counts the coordinates of the lines in [begin, end), the words between
+// blanks, into numCoors. Sets dim to the number of coordinates of the first
+// line which is not blank, if not set yet. Returns false if a line has not
+// dim coordinates.
+static bool countCoors(const char* begin, const char* end, size_t& dim,
+                       size_t& numCoors) {
+    numCoors = 0;
+    for (const char* c = begin; c < end; c++) {
+        size_t lineCoors = 0;
+        while (c < end && *c != '\n') {
+            if (isBlank(*c)) {
+                c++;
+                continue;
+            }
+            lineCoors++;
+            while (c < end && *c != '\n' && !isBlank(*c)) {
+                c++;
+            }
+        }
+        if (lineCoors == 0) {
+            continue;
+        }
+        if (dim == 0) {
+            dim = lineCoors;
+        } else if (lineCoors != dim) {
+            return false;
+        }
+        numCoors += lineCoors;
+    }
+    return true;
+}
+
+// Writes the coordinates of the lines in [begin, end) to coors, which has
+// room for all of them. Returns false if a coordinate is not a number.
+static bool parseCoors(const char* begin, const char* end, float* coors) {
+    for (const char* c = begin; c < end;) {
+        if (isBlank(*c) || *c == '\n') {
+            c++;
+            continue;
+        }
+        // from_chars does not accept an explicit plus sign
+        if (*c == '+') {
+            c++;
+        }
+        auto result = std::from_chars(c, end, *coors);
+        if (result.ec != std::errc() ||
+            (result.ptr < end && !isBlank(*result.ptr) &&
+             *result.ptr != '\n')) {
+            return false;
+        }
+        coors++;
+        c = result.ptr;
+    }
+    return true;
+}
+
+// Returns the value of key in the header of a .npy file, a python
+// dictionary literal, or an empty string if it is not there
+static std::string npyField(const std::string& header,
+                            const std::string& key) {
+    size_t pos = header.find("'" + key + "'");
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos = header.find(':', pos);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos = header.find_first_not_of(' ', pos + 1);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    // Strings and tuples end with their delimiter, the rest before a comma
+    size_t end;
+    if (header[pos] == '\'') {
+        end = header.find('\'', pos + 1);
+    } else if (header[pos] == '(') {
+        end = header.find(')', pos);
+    } else {
+        end = header.find_first_of(",}", pos);
+        if (end != std::string::npos) {
+            end = header.find_last_not_of(' ', end - 1);
+        }
+    }
+    if (end == std::string::npos) {
+        return "";
+    }
+    return header.substr(pos, end - pos + 1);
+}
+
+PointCloud::PointCloud()
+    : dim_(0), size_(0), coors_(nullptr), map_(nullptr), mapSize_(0) {}
+
+PointCloud::~PointCloud() { clear(); }
+
+void PointCloud::clear() {
+    if (map_ != nullptr) {
+        munmap(map_, mapSize_);
+    }
+    dim_ = size_ = mapSize_ = 0;
+    coors_ = nullptr;
+    map_ = nullptr;
+    std::vector<float>().swap(buffer_);
+}
+
+bool PointCloud::read(const std::string& filename) {
+    clear();
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = status.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    map_ = map;
+    mapSize_ = size;
+
+    const char* data = static_cast<const char*>(map);
+    bool npy =
+        size >= NPY_MAGIC_SIZE && memcmp(data, NPY_MAGIC, NPY_MAGIC_SIZE) == 0;
+    bool read = npy ? readNpy(data, size) : readText(data, size);
+    if (!read) {
+        clear();
+    } else if (coors_ == buffer_.data()) {
+        // The map is only kept while the coordinates are in it
+        munmap(map_, mapSize_);
+        map_ = nullptr;
+        mapSize_ = 0;
+    }
+    return read;
+}
+
+void PointCloud::release(size_t first, size_t last) const {
+    if (map_ == nullptr || first >= last) {
+        return;
+    }
+    // Only the pages entirely in the range
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(point(first));
+    uintptr_t end = reinterpret_cast<uintptr_t>(point(last));
+    begin = (begin + pageSize - 1) / pageSize * pageSize;
+    end = end / pageSize * pageSize;
+    if (begin < end) {
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+    }
+}
+
+bool PointCloud::readText(const char* data, size_t size) {
+    // Every chunk but the last one ends after a line break
+    size_t numChunks = chunksFor(size, MIN_BYTES_PER_CHUNK);
+    std::vector<size_t> bounds = {0};
+    for (size_t chunk = 1; chunk < numChunks; chunk++) {
+        size_t bound = std::max(bounds.back(), size * chunk / numChunks);
+        const void* lineBreak = memchr(data + bound, '\n', size - bound);
+        bounds.push_back(lineBreak == nullptr
+                             ? size
+                             : static_cast<const char*>(lineBreak) - data + 1);
+    }
+    bounds.push_back(size);
+
+    // Chunks are counted first, so that each one is then parsed straight
+    // to its place in the buffer
+    std::vector<size_t> dims(numChunks, 0), numCoors(numChunks);
+    std::vector<char> valid(numChunks);
+    parallelChunks(numChunks, numChunks, [&](size_t chunk, size_t, size_t) {
+        valid[chunk] = countCoors(data + bounds[chunk],
+                                  data + bounds[chunk + 1], dims[chunk],
+                                  numCoors[chunk]);
+    });
+    std::vector<size_t> offsets = {0};
+    for (size_t chunk = 0; chunk < numChunks; chunk++) {
+        if (!valid[chunk] ||
+            (dims[chunk] != 0 && dim_ != 0 && dims[chunk] != dim_)) {
+            return false;
+        }
+        dim_ = std::max(dim_, dims[chunk]);
+        offsets.push_back(offsets.back() + numCoors[chunk]);
+    }
+    buffer_.resize(offsets.back());
+    parallelChunks(numChunks, numChunks, [&](size_t chunk, size_t, size_t) {
+        valid[chunk] = parseCoors(data + bounds[chunk],
+                                  data + bounds[chunk + 1],
+                                  buffer_.data() + offsets[chunk]);
+    });
+    if (std::find(valid.begin(), valid.end(), false) != valid.end()) {
+        return false;
+    }
+    size_ = dim_ == 0 ? 0 : buffer_.size() / dim_;
+    coors_ = buffer_.data();
+    return true;
+}
+
+bool PointCloud::readNpy(const char* data, size_t size) {
+    // Magic, major and minor version, and the header length in 2 bytes for
+    // version 1 or 4 bytes for later ones, little endian
+    if (size < NPY_MAGIC_SIZE + 2) {
+        return false;
+    }
+    size_t lengthSize = data[NPY_MAGIC_SIZE] == 1 ? 2 : 4;
+    size_t headerStart = NPY_MAGIC_SIZE + 2 + lengthSize;
+    if (size < headerStart) {
+        return false;
+    }
+    size_t headerLength = 0;
+    for (size_t b = 0; b < lengthSize; b++) {
+        uint8_t byte = data[NPY_MAGIC_SIZE + 2 + b];
+        headerLength |= size_t(byte) << (8 * b);
+    }
+    size_t dataStart = headerStart + headerLength;
+    if (size < dataStart) {
+        return false;
+    }
+    std::string header(data + headerStart, headerLength);
+
+    std::string descr = npyField(header, "descr");
+    std::string shape = npyField(header, "shape");
+    size_t itemSize;
+    if (descr == "'<f4'") {
+        itemSize = 4;
+    } else if (descr == "'<f8'") {
+        itemSize = 8;
+    } else {
+        return false;
+    }
+    if (npyField(header, "fortran_order") != "False" || shape.empty()) {
+        return false;
+    }
+
+    // Shapes are (points,) for dimension 1 or (points, dim)
+    std::vector<size_t> sizes;
+    for (const char* c = shape.data() + 1; c < shape.data() + shape.size();) {
+        if (*c < '0' || *c > '9') {
+            c++;
+            continue;
+        }
+        size_t value;
+        auto result = std::from_chars(c, shape.data() + shape.size(), value);
+        if (result.ec != std::errc()) {
+            return false;
+        }
+        c = result.ptr;
+        sizes.push_back(value);
+    }
+    if (sizes.empty() || sizes.size() > 2) {
+        return false;
+    }
+    // The shape comes from the file, so its size in bytes must not overflow
+    // before it is checked against the data
+    size_t numPoints = sizes[0], dim = sizes.size() == 1 ? 1 : sizes[1];
+    if (dim == 0 || numPoints > SIZE_MAX / dim / itemSize) {
+        return false;
+    }
+    size_t numCoors = numPoints * dim;
+    if ((size - dataStart) / itemSize < numCoors) {
+        return false;
+    }
+
+    dim_ = numPoints == 0 ? 0 : dim;
+    size_ = numPoints;
+    if (itemSize == sizeof(float) && dataStart % alignof(float) == 0) {
+        coors_ = reinterpret_cast<const float*>(data + dataStart);
+        return true;
+    }
+    // Doubles are rounded to floats, as text coordinates are
+    buffer_.resize(numCoors);
+    size_t numChunks = chunksFor(numCoors * itemSize, MIN_BYTES_PER_CHUNK);
+    parallelChunks(numCoors, numChunks, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (itemSize == sizeof(float)) {
+                memcpy(&buffer_[i], data + dataStart + i * itemSize,
+                       sizeof(float));
+            } else {
+                double value;
+                memcpy(&value, data + dataStart + i * itemSize,
+                       sizeof(double));
+                buffer_[i] = value;
+            }
+        }
+    });
+    coors_ = buffer_.data();
+    return true;
+}
+
+bool PointCloud::writeNpy(const std::string& filename) const {
+    std::string header =
+        "{'descr': '<f4', 'fortran_order': False, 'shape': (" +
+        std::to_string(size_) + ", " + std::to_string(dim_) + "), }";
+    // Padded with spaces and a line break so that the data is aligned
+    size_t prefix = NPY_MAGIC_SIZE + 2 + 2;
+    header.append(NPY_ALIGNMENT - (prefix + header.size() + 1) % NPY_ALIGNMENT,
+                  ' ');
+    header += '\n';
+    assert(header.size() < 1 << 16);
+
+    std::ofstream file(filename, std::ios::binary);
+    char version[] = {1, 0};
+    char length[] = {char(header.size() & 0xff), char(header.size() >> 8)};
+    file.write(NPY_MAGIC, NPY_MAGIC_SIZE);
+    file.write(version, 2);
+    file.write(length, 2);
+    file << header;
+    file.write(reinterpret_cast<const char*>(coors_),
+               size_ * dim_ * sizeof(float));
+    return bool(file);
+}
@@ -0,0 +1,55 @@
+#pragma once
+// file: cloud.h
+// description: reads point clouds from files into a flat buffer
+
+#include <string>
+#include <vector>
+
+namespace cubitos {
+
+// Point cloud as read from a file: the coordinates of every point one after
+// the other, dim() of them per point. Clouds of float32 in .npy files are
+// used from the file mapped in memory, without copying them, the rest are
+// converted to a buffer.
+class PointCloud {
+   public:
+    PointCloud();
+    ~PointCloud();
+    PointCloud(const PointCloud&) = delete;
+    PointCloud& operator=(const PointCloud&) = delete;
+
+    // Reads a cloud from a file, whose format is detected by its first
+    // bytes: either a .npy array of float32 or float64 of shape (points,
+    // dim), or text with a point per line, its coordinates separated by
+    // blanks. Text is split at line boundaries into chunks parsed
+    // concurrently, blank lines are skipped. Returns false if the file can't
+    // be read, an array has another type or order, a coordinate is not a
+    // number or lines have different numbers of coordinates.
+    bool read(const std::string& filename);
+    // Writes the cloud as a .npy array of float32 of shape (size(), dim()).
+    // Returns false if the file can't be written.
+    bool writeNpy(const std::string& filename) const;
+
+    // Tells that the points in [first, last) won't be read again, so that
+    // the pages of a mapped file holding them can be dropped
+    void release(size_t first, size_t last) const;
+
+    size_t dim() const { return dim_; }
+    size_t size() const { return size_; }
+    const float* point(size_t i) const { return coors_ + i * dim_; }
+
+   private:
+    bool readText(const char* data, size_t size);
+    bool readNpy(const char* data, size_t size);
+    // Forgets the cloud and releases the file mapped
+    void clear();
+
+    size_t dim_, size_;
+    // Coordinates, either in buffer_ or in the file mapped
+    const float* coors_;
+    std::vector<float> buffer_;
+    void* map_;
+    size_t mapSize_;
+};
+
+}  // namespace cubitos
@@ -4,22 +4,28 @@
  * description: Global configuration file for the program
  */
 
-#include <bitset>
 #include <cstdint>
 
-// Bitsize is defined as a constant because we only want one bitsize per
-// compilation, since it is optimized for the number of bits of the
-// architecture. Only 32 and 64 bits are supported
+// Coordinates are unsigned integers, of the smallest of these types with
+// room for the depth asked. Every class depending on the coordinates is
+// instantiated for each type T with X(T). Expanding to depth d looks for
+// points in cells of depth d + 1, whose vertices have depth d + 2, so
+// coordinates need d + 2 bits.
+#define FOR_EACH_COOR(X) X(uint16_t) X(uint32_t) X(uint64_t)
 
-#if INTPTR_MAX == INT32_MAX
-static const int NUMBITS = 32;
-#elif INTPTR_MAX == INT64_MAX
-static const int NUMBITS = 64;
-#else
-#error The program wont support this ISA
-#endif
+// Dimensions of the point clouds with a precompiled pipeline, every class
+// depending on the dimension is instantiated for each D with X(D, ...).
+// Clouds of other dimensions are rejected.
+#define FOR_EACH_DIM(X, ...) \
+    X(1, __VA_ARGS__) X(2, __VA_ARGS__) X(3, __VA_ARGS__) X(4, __VA_ARGS__)
 
-// Bitmasks are defined according to NUMBITS
-static const std::bitset<NUMBITS> ALLONES = (uint64_t)-1 >> (64 - NUMBITS);
-static const std::bitset<NUMBITS> BIGONE = 1LL << (NUMBITS - 1);
-static const std::bitset<NUMBITS> SMALLONE = 1LL;
+// Matrices are stored as sparse columns unless DENSE_MATRICES is defined, in
+// which case the LinBox dense matrices are used. Boundary and basis change
+// matrices have very few nonzeros per column, so the dense backend is only
+// kept to compare results (make DENSE=1).
+
+// Complexes expanded and collapsed ahead of the modules by a thread of their
+// own, so that expanding the next depths overlaps with the reductions of the
+// current one. Each one ahead is kept in memory until its modules are
+// computed. 0 expands every complex in turn with its modules.
+#define EXPANDED_AHEAD 1
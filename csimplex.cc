@@ -2,178 +2,200 @@
 
 #include "csimplex.h"
 
-#include "bitset_operators.h"
+#include <cassert>
 
 using namespace cubitos;
 
-CSimplex::CSimplex(Point center, size_t depth, size_t dim)
-    : dim_(dim), center_(center), depth_(depth) {
-    center_.directions(depth_, directions_, nondirections_);
-}
-
-std::vector<CSimplex> CSimplex::expansions(Region& region) const {
-    std::vector<CSimplex> expansions;
-    auto coors = center_.coors_;
-
-    expansionsRec(region, nondirections_.begin(), expansions, coors,
-                  center_.dim_);
-
-    return expansions;
-}
-
-void CSimplex::expansionsRec(Region& region,
-                             std::vector<int>::const_iterator it,
-                             std::vector<CSimplex>& expansions,
-                             std::vector<std::bitset<NUMBITS>>& coors,
-                             size_t dim) const {
-    if (it == nondirections_.end() || dim == dim_) {
-        // We've got a combination, deep copy and push
-        CSimplex possible_simplex(Point(coors), depth_ + 1, dim);
-        if (possible_simplex.checkSimplex(region)) {
-            expansions.push_back(possible_simplex);
-        }
-    } else {
-        expansionsRec(region, it + 1, expansions, coors, dim);
-        std::bitset<NUMBITS> previousValue = coors[*it];
-        coors[*it] -= (BIGONE >> (depth_ + 1));
-        expansionsRec(region, it + 1, expansions, coors, dim - 1);
-        coors[*it] = previousValue + (BIGONE >> (depth_ + 1));
-        expansionsRec(region, it + 1, expansions, coors, dim - 1);
-        coors[*it] = previousValue;
-    }
-}
-
-bool CSimplex::checkSimplex(Region& region) const {
-    std::bitset<NUMBITS> offset = BIGONE >> (depth_ + 1);
-    auto coors = center_.coors_;
-
-    return checkSimplexRecDir(region, directions_.begin(), coors, offset,
-                              directions_.size());
-}
-
-bool CSimplex::checkSimplexRecDir(Region& region,
-                                  std::vector<int>::const_iterator it,
-                                  std::vector<std::bitset<NUMBITS>>& coors,
-                                  std::bitset<NUMBITS> offset, int k) const {
-    if (k == 0) {
-        return checkSimplexRecNonDir(region, nondirections_.begin(), coors,
-                                     offset, nondirections_.size());
-    } else {
-        std::bitset<NUMBITS> previousValue = coors[*it];
-        coors[*it] += offset;
-        bool isPlus = checkSimplexRecDir(region, it + 1, coors, offset, k - 1);
-        coors[*it] = previousValue - offset;
-        bool isMinus =
-            checkSimplexRecDir(region, it + 1, coors, offset, k - 1);
-        coors[*it] = previousValue;
-        if (!(isPlus && isMinus)) {
-            return false;
+static constexpr size_t pow3(size_t n) { return n == 0 ? 1 : 3 * pow3(n - 1); }
+
+// Offsets from the center of a simplex of dimension D to its expansions,
+// vertices and faces, in units of the offset of the depth. They only depend
+// on the directions of the simplex, so they are computed at compile time for
+// every mask of directions.
+template <size_t D>
+struct SimplexTables {
+    static const size_t NUM_MASKS = 1 << D;
+
+    // Expansion of a simplex: how each coordinate moves and its directions
+    struct Expansion {
+        int8_t signs[D] = {};
+        uint8_t directions = 0;
+    };
+    // Face of a simplex: the coordinate moved, how, and its coefficient in
+    // the boundary
+    struct Face {
+        uint8_t coordinate = 0;
+        int8_t sign = 0;
+        int8_t coefficient = 0;
+    };
+
+    // Every non-direction is kept, moved down or moved up, in the order of a
+    // base 3 counter whose first digit is the first non-direction. A kept
+    // non-direction becomes a direction.
+    Expansion expansions[NUM_MASKS][pow3(D)] = {};
+    size_t numExpansions[NUM_MASKS] = {};
+    // The 2^D vertices of a simplex in groups, one for each corner: the
+    // directions are fixed in a group and the non-directions take every
+    // sign. A simplex is in a region if every group has a vertex in it.
+    int8_t vertices[NUM_MASKS][1 << D][D] = {};
+    // Both faces of every direction, with alternating coefficients
+    Face faces[NUM_MASKS][2 * D] = {};
+    size_t numFaces[NUM_MASKS] = {};
+
+    constexpr SimplexTables() {
+        for (size_t mask = 0; mask < NUM_MASKS; mask++) {
+            size_t nondirections[D] = {}, directions[D] = {};
+            size_t numNondirections = 0, numDirections = 0;
+            for (size_t i = 0; i < D; i++) {
+                if (mask >> i & 1) {
+                    directions[numDirections++] = i;
+                } else {
+                    nondirections[numNondirections++] = i;
+                }
+            }
+
+            numExpansions[mask] = pow3(numNondirections);
+            for (size_t e = 0; e < numExpansions[mask]; e++) {
+                auto& expansion = expansions[mask][e];
+                expansion.directions = mask;
+                for (size_t j = numNondirections, rest = e; j > 0; j--) {
+                    size_t i = nondirections[j - 1], digit = rest % 3;
+                    rest /= 3;
+                    if (digit == 0) {
+                        expansion.directions |= 1 << i;
+                    } else {
+                        expansion.signs[i] = digit == 1 ? -1 : 1;
+                    }
+                }
+            }
+
+            // Vertex v has the sign of bit j of v for the j-th non-direction
+            // and of bit numNondirections + j for the j-th direction, plus
+            // when unset
+            for (size_t v = 0; v < (1u << D); v++) {
+                for (size_t j = 0; j < numNondirections; j++) {
+                    vertices[mask][v][nondirections[j]] =
+                        (v >> j & 1) ? -1 : 1;
+                }
+                for (size_t j = 0; j < numDirections; j++) {
+                    vertices[mask][v][directions[j]] =
+                        (v >> (numNondirections + j) & 1) ? -1 : 1;
+                }
+            }
+
+            numFaces[mask] = 2 * numDirections;
+            for (size_t j = 0; j < numDirections; j++) {
+                int8_t coefficient = j % 2 == 0 ? 1 : -1;
+                faces[mask][2 * j] = {uint8_t(directions[j]), 1, coefficient};
+                faces[mask][2 * j + 1] = {uint8_t(directions[j]), -1,
+                                          int8_t(-coefficient)};
+            }
         }
     }
-    return true;
-}
-
-bool CSimplex::checkSimplexRecNonDir(Region& region,
-                                     std::vector<int>::const_iterator it,
-                                     std::vector<std::bitset<NUMBITS>>& coors,
-                                     std::bitset<NUMBITS> offset,
-                                     int k) const {
-    if (k == 0) {
-        return region.containsInDepth(Point(coors),
-                                      Point(coors).depthAsCenter());
-    } else {
-        std::bitset<NUMBITS> previousValue = coors[*it];
-        coors[*it] += offset;
-        if (checkSimplexRecNonDir(region, it + 1, coors, offset, k - 1)) {
-            coors[*it] = previousValue;
-            return true;
+};
+
+template <size_t D>
+static constexpr SimplexTables<D> TABLES = SimplexTables<D>();
+
+template <size_t D, class T>
+CSimplex<D, T>::CSimplex(const Point<D, T>& center, size_t depth)
+    : center_(center), depth_(depth), directions_(center.directions(depth)) {}
+
+template <size_t D, class T>
+CSimplex<D, T>::CSimplex(const Point<D, T>& center, size_t depth,
+                         unsigned directions)
+    : center_(center), depth_(depth), directions_(directions) {}
+
+template <size_t D, class T>
+size_t CSimplex<D, T>::expansions(const OccupancyCache<D, T>& occupied,
+                                  std::vector<CSimplex<D, T>>& dest) const {
+    assert(occupied.depth() == depth_ + 2u);
+    T offset = Point<D, T>::BIGONE >> (depth_ + 1);
+    size_t numExpansions = 0;
+    for (size_t e = 0; e < TABLES<D>.numExpansions[directions_]; e++) {
+        const auto& expansion = TABLES<D>.expansions[directions_][e];
+        std::array<T, D> coors;
+        for (size_t i = 0; i < D; i++) {
+            coors[i] = T(center_.coors_[i] + expansion.signs[i] * offset);
         }
-        coors[*it] = previousValue - offset;
-        if (checkSimplexRecNonDir(region, it + 1, coors, offset, k - 1)) {
-            coors[*it] = previousValue;
-            return true;
+        if (checkSimplex(occupied, coors, expansion.directions,
+                         depth_ + 1)) {
+            dest.push_back(CSimplex<D, T>(Point<D, T>(coors), depth_ + 1,
+                                          expansion.directions));
+            numExpansions++;
         }
-        coors[*it] = previousValue;
     }
-    return false;
+    return numExpansions;
 }
 
-CChain CSimplex::differential() const {
-    CChain chain = CChain();
-    if (dim_ == 0) return chain;
-
-    std::bitset<NUMBITS> shift = BIGONE >> depth_;
-    bool rotate = false;
-    for (auto d : directions_) {
-        Point a = center_, b = center_;
-        a.coors_[d] += shift;
-        b.coors_[d] -= shift;
-        if (!rotate) {
-            chain += CSimplex(a, depth_, dim_ - 1);
-            chain -= CSimplex(b, depth_, dim_ - 1);
-        } else {
-            chain += CSimplex(b, depth_, dim_ - 1);
-            chain -= CSimplex(a, depth_, dim_ - 1);
+template <size_t D, class T>
+bool CSimplex<D, T>::checkSimplex(const OccupancyCache<D, T>& occupied,
+                                  const std::array<T, D>& coors,
+                                  unsigned directions, size_t depth) {
+    T offset = Point<D, T>::BIGONE >> (depth + 1);
+    const auto& vertices = TABLES<D>.vertices[directions];
+    size_t groupSize = 1 << (D - __builtin_popcount(directions));
+    for (size_t group = 0; group < (1u << D); group += groupSize) {
+        bool found = false;
+        for (size_t v = group; v < group + groupSize && !found; v++) {
+            Point<D, T> vertex;
+            for (size_t i = 0; i < D; i++) {
+                vertex.coors_[i] = T(coors[i] + vertices[v][i] * offset);
+            }
+            found = occupied.contains(vertex);
+        }
+        if (!found) {
+            return false;
         }
-        rotate = !rotate;
-    }
-
-    return chain;
-}
-
-bool CSimplex::operator<(const CSimplex& rhs) const {
-    if (dim_ < rhs.dim_) {
-        return true;
-    }
-    if (dim_ > rhs.dim_) {
-        return false;
-    }
-    if (depth_ < rhs.depth_) {
-        return true;
-    }
-    if (depth_ > rhs.depth_) {
-        return false;
     }
-    return center_ < rhs.center_;
+    return true;
 }
 
-bool CSimplex::operator==(const CSimplex& rhs) const {
-    if (dim_ != rhs.dim_) {
-        return false;
+template <size_t D, class T>
+size_t CSimplex<D, T>::boundary(CSimplex<D, T>* faces,
+                                int* coefficients) const {
+    T shift = Point<D, T>::BIGONE >> depth_;
+    size_t numFaces = TABLES<D>.numFaces[directions_];
+    for (size_t f = 0; f < numFaces; f++) {
+        const auto& face = TABLES<D>.faces[directions_][f];
+        Point<D, T> center = center_;
+        center.coors_[face.coordinate] =
+            T(center.coors_[face.coordinate] + face.sign * shift);
+        faces[f] = CSimplex<D, T>(center, depth_,
+                                  directions_ & ~(1u << face.coordinate));
+        coefficients[f] = face.coefficient;
     }
-    if (depth_ != rhs.depth_) {
-        return false;
-    }
-    return center_ == rhs.center_;
+    return numFaces;
 }
 
-CChain::CChain() {};
-
-CChain& CChain::operator+=(CSimplex csimplex) {
-    simplices[csimplex] += 1;
-    return *this;
-}
-
-CChain& CChain::operator-=(CSimplex csimplex) {
-    simplices[csimplex] -= 1;
-    return *this;
+template <size_t D, class T>
+bool CSimplex<D, T>::operator==(const CSimplex<D, T>& rhs) const {
+    // The directions follow from the center and the depth
+    return depth_ == rhs.depth_ && center_ == rhs.center_;
 }
 
 #ifdef DEBUG
+template <size_t D, class T>
 std::ostream& cubitos::operator<<(std::ostream& out,
-                                  const CSimplex& csimplex) {
-    out << "<CSimplex dim=" << csimplex.dim_
+                                  const CSimplex<D, T>& csimplex) {
+    out << "<CSimplex dim=" << csimplex.dim()
         << ", depth=" << (int)csimplex.depth_ << " and center "
         << csimplex.center_ << ">";
 
     return out;
 }
 
-std::ostream& cubitos::operator<<(std::ostream& out, const CChain& cchain) {
-    for (auto s : cchain.simplices) {
-        out << s.first << ' ' << s.second << ", ";
-    }
+#endif  // DEBUG
 
-    return out;
-}
+#ifdef DEBUG
+#define INSTANTIATE_CSIMPLEX_DEBUG(D, T)                      \
+    template std::ostream& cubitos::operator<<(std::ostream&, \
+                                               const CSimplex<D, T>&);
+#else
+#define INSTANTIATE_CSIMPLEX_DEBUG(D, T)
 #endif  // DEBUG
+#define INSTANTIATE_CSIMPLEX(D, T)          \
+    template class cubitos::CSimplex<D, T>; \
+    INSTANTIATE_CSIMPLEX_DEBUG(D, T)
+#define INSTANTIATE_CSIMPLICES(T) FOR_EACH_DIM(INSTANTIATE_CSIMPLEX, T)
+FOR_EACH_COOR(INSTANTIATE_CSIMPLICES)
@@ -5,73 +5,67 @@
  *      expand and checkSimplex operation
  */
 
-#include <map>
-
+#include "occupancy.h"
 #include "point.h"
-#include "region.h"
 
 namespace cubitos {
 
-struct CChain;
-
+// A cube of the mesh of some depth, stored as its center, its depth and the
+// coordinates along which it extends as a bitmask, so that simplices are
+// small and trivially copyable
+template <size_t D, class T>
 class CSimplex {
+    static_assert(D <= 8, "Directions are stored in 8 bits");
+
    public:
     // Constructors
     CSimplex() {};
-    CSimplex(Point center, size_t depth, size_t dim);
+    // Pre: center is a center of depth <depth>
+    CSimplex(const Point<D, T>& center, size_t depth);
 
-    // Returns all possible simplex expansions
-    std::vector<CSimplex> expansions(Region& region) const;
-    // Returns the image of the boundary map
-    CChain differential() const;
+    // Appends the simplex expansions with their vertices in the region to
+    // dest, in a fixed order, and returns how many there are
+    // Pre: occupied holds the cells of depth depth + 2 of the region
+    size_t expansions(const OccupancyCache<D, T>& occupied,
+                      std::vector<CSimplex<D, T>>& dest) const;
+    // Writes the faces of the simplex to faces and their coefficients in its
+    // boundary to coefficients, at most 2 * D of each, and returns how many
+    // there are
+    size_t boundary(CSimplex<D, T>* faces, int* coefficients) const;
 
-    // Order relationship for std::map. Doesn't have any real meaning.
-    bool operator<(const CSimplex& rhs) const;
-    bool operator==(const CSimplex& rhs) const;
+    bool operator==(const CSimplex<D, T>& rhs) const;
 
-    size_t dim_;
+    const Point<D, T>& center() const { return center_; }
+    // Number of coordinates along which the simplex extends
+    size_t dim() const { return __builtin_popcount(directions_); }
 
 #ifdef DEBUG
+    template <size_t E, class U>
     friend std::ostream& operator<<(std::ostream& out,
-                                    const CSimplex& csimplex);
-    Point get_center() const { return center_; };  // for plotting
-#endif                                             // DEBUG
+                                    const CSimplex<E, U>& csimplex);
+    Point<D, T> get_center() const { return center_; };  // for plotting
+#endif                                                   // DEBUG
 
    private:
-    void expansionsRec(Region& region, std::vector<int>::const_iterator it,
-                       std::vector<CSimplex>& expansions,
-                       std::vector<std::bitset<NUMBITS>>& coors,
-                       size_t dim) const;
-
-    bool checkSimplex(Region& region) const;
-    bool checkSimplexRecDir(Region& region,
-                            std::vector<int>::const_iterator it,
-                            std::vector<std::bitset<NUMBITS>>& coors,
-                            std::bitset<NUMBITS> offset, int k) const;
-
-    bool checkSimplexRecNonDir(Region& region,
-                               const std::vector<int>::const_iterator it,
-                               std::vector<std::bitset<NUMBITS>>& coors,
-                               std::bitset<NUMBITS> offset, int k) const;
-
-    Point center_;
-    size_t depth_;
-    std::vector<int> directions_, nondirections_;
-    std::vector<int> simplices;
-};
-
-// Element in a chain complex
-struct CChain {
-    CChain();
-    CChain& operator+=(CSimplex csimplex);
-    CChain& operator-=(CSimplex csimplex);
-
-    std::map<CSimplex, int> simplices;
+    // Pre: directions are the directions of center at depth
+    CSimplex(const Point<D, T>& center, size_t depth, unsigned directions);
+
+    // Whether the simplex of depth <depth> with center coors and directions
+    // has its vertices in the region
+    // Pre: occupied holds the cells of depth depth + 1
+    static bool checkSimplex(const OccupancyCache<D, T>& occupied,
+                             const std::array<T, D>& coors,
+                             unsigned directions, size_t depth);
+
+    Point<D, T> center_;
+    uint8_t depth_;
+    // Bit i is set if the simplex extends along the i-th coordinate
+    uint8_t directions_;
 };
 
 #ifdef DEBUG
-std::ostream& operator<<(std::ostream& out, const CSimplex& csimplex);
-std::ostream& operator<<(std::ostream& out, const CChain& cchain);
+template <size_t D, class T>
+std::ostream& operator<<(std::ostream& out, const CSimplex<D, T>& csimplex);
 
 #endif  // DEBUG
 
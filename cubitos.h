@@ -3,87 +3,223 @@
 // description: main class of our program. Loads a point cloud and
 //      computes cubical persistent homology on it
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include "ccomplex.h"
+#include "cloud.h"
+#include "config.h"
 #include "csimplex.h"
+#include "keys.h"
 #include "module.h"
+#include "parallel.h"
 #include "region.h"
 #include "smatrix.h"
 
 namespace cubitos {
 
-// _N is the prime for the finite field
-template <int _N>
+template <size_t D, class T>
 class Cubitos {
    public:
-    // A persistentor class is related to  a cloud of points
-    // Pre: points is not empty
-    Cubitos(std::vector<std::vector<float>> points) {
-        // We want a sorted cloud of points, first we transform them from float
-        std::vector<std::bitset<NUMBITS>> center;
-
-        assert(!points.empty());
-
-        spaceDimension_ = points.begin()->size();
-        cloud_.push_back(Point(points[0]));
-
-        for (auto point_it = points.begin() + 1; point_it != points.end();
-             point_it++) {
-            assert(point_it->size() == spaceDimension_);
-            cloud_.push_back(Point(*point_it));
+    // A persistentor class is related to  a cloud of points. Homology is
+    // computed with coefficients in Z/p for every p in primes, up to
+    // maxDepth at most. Keys of the points are sorted out of core if
+    // memoryBudget is not 0, keeping about memoryBudget bytes of them in
+    // memory. If that fails error() tells why and nothing else may be called.
+    // Pre: points is not empty and of dimension D, maxDepth + 2 <=
+    // Point<D, T>::NUMBITS, primes have a module in MODULE_FACTORIES
+    Cubitos(const PointCloud& points, size_t maxDepth,
+            const std::vector<size_t>& primes = {11},
+            size_t memoryBudget = 0)
+        : maxDepth_(maxDepth),
+          keys_(std::max<size_t>(1, (D * (maxDepth + 1) + 63) / 64),
+                memoryBudget),
+          numMerged_(0),
+          depth_(0) {
+        assert(points.size() > 0 && points.dim() == D);
+        assert(maxDepth_ + 2 <= size_t(Point<D, T>::NUMBITS));
+
+        // Points are converted concurrently to their Morton keys, in batches
+        // which fit in the budget. The sorted keys index the cloud, points
+        // are not kept. Expanding to maxDepth only looks for points in cells
+        // of maxDepth + 1, so keys stop there and the points of a cell are
+        // merged into one.
+        size_t levels = maxDepth_ + 1, keyWords = keys_.keyWords();
+        for (size_t first = 0; first < points.size();) {
+            size_t numPoints =
+                std::min(points.size() - first, keys_.maxBatch());
+            uint64_t* keys = keys_.append(numPoints);
+            if (keys == nullptr) {
+                return;
+            }
+            size_t numChunks = chunksFor(numPoints, MIN_POINTS_PER_CHUNK);
+            parallelChunks(
+                numPoints, numChunks, [&](size_t, size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++) {
+                        Point<D, T>(points.point(first + i))
+                            .mortonKey(levels, keys + i * keyWords);
+                    }
+                });
+            points.release(first, first + numPoints);
+            first += numPoints;
         }
-
-        std::sort(cloud_.begin(), cloud_.end());
-
-        // Points should be unique
-        for (auto point_it = points.begin(); point_it != points.end() - 1;
-             point_it++) {
-            assert(*point_it != *(point_it + 1));
+        if (!keys_.sort()) {
+            return;
         }
+        numMerged_ = points.size() - keys_.size();
 
         // Now we have confirmed that the cloud is well-formed, there shouldn't
         // be any more errors.
 
-        for (size_t i = 0; i < spaceDimension_; i++) {
-            center.push_back(BIGONE);
-        }
+        std::array<T, D> center;
+        center.fill(Point<D, T>::BIGONE);
 
-        region_ = Region(0, cloud_.begin(), cloud_.end());
+        region_ = Region<D, T>(keys_, levels);
 
-        CComplex init_complex(0, &region_);
-        init_complex.add(CSimplex(center, 0, 0));
-        module_ = Module<_N>(init_complex);
+        lastComplex_ = CComplex<D, T>(0, &region_);
+        lastComplex_.add(CSimplex<D, T>(center, 0));
+        for (auto prime : primes) {
+            modules_.push_back(makeModule(prime, lastComplex_));
+            assert(modules_.back());
+        }
     }
 
-    // Computes the cubical complex up to <depth> depth
-    void addToLevel(size_t depth) { module_.addToLevel(depth); }
+    // Computes the cubical complex up to <depth> depth. Each complex is
+    // expanded once and shared by the modules of every prime, which are
+    // computed concurrently, while the next complexes are expanded
+    // Pre: depth <= maxDepth and error() == 0
+    void addToLevel(size_t depth) {
+        assert(depth <= maxDepth_ && error() == 0);
+        if (EXPANDED_AHEAD > 0 && depth > depth_ + 1) {
+            pipelineToLevel(depth);
+            return;
+        }
+        for (; depth_ < depth; depth_++) {
+            CComplex<D, T> complex = lastComplex_.expand();
+            complex.collapse();
+            forEachModule([&](size_t i) {
+                modules_[i]->addLevel(lastComplex_, complex);
+            });
+            lastComplex_ = std::move(complex);
+        }
+    }
 
-    // Returns the computed barcode
-    Barcode barcode() { return module_.computeBarcode(); }
+    // Number of points merged with another one in the same cell
+    size_t numMerged() const { return numMerged_; }
+    // The errno of the failure to sort the keys out of core, or 0 if they
+    // were sorted
+    int error() const { return keys_.error(); }
+
+    // Returns the computed barcodes, one for each prime
+    std::vector<Barcode> barcodes() {
+        std::vector<Barcode> bcodes(modules_.size());
+        forEachModule(
+            [&](size_t i) { bcodes[i] = modules_[i]->computeBarcode(); });
+        return bcodes;
+    }
 
 // Debugging functions
 #ifdef DEBUG
-    template <int _M>
-    friend std::ostream& operator<<(std::ostream& out, const Cubitos<_M>& p);
+    template <size_t E, class U>
+    friend std::ostream& operator<<(std::ostream& out, const Cubitos<E, U>& p);
 #endif  // DEBUG
 
    private:
-    std::vector<Point> cloud_;
+    // Points keyed by a thread at least
+    static const size_t MIN_POINTS_PER_CHUNK = 4096;
+
+    // Calls f(i) for the index of every module, with a thread for each one
+    // if there are several
+    template <class F>
+    void forEachModule(F f) {
+        if (modules_.size() == 1) {
+            f(0);
+            return;
+        }
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < modules_.size(); i++) {
+            workers.emplace_back(f, i);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
 
-    std::vector<CComplex> complexes_;
-    Module<_N> module_;
-    Region region_;
+    // Adds the levels up to depth like addToLevel, but a producer thread
+    // expands and collapses the complexes, at most EXPANDED_AHEAD ahead of
+    // the ones the modules are computing. Expanding only needs the last
+    // complex and the region, which nobody modifies
+    void pipelineToLevel(size_t depth) {
+        // Complexes from lastComplex_ to the last one expanded. The producer
+        // only adds them at the back and the modules only remove them from
+        // the front, and never the last one, so references to them stay
+        // valid while the other thread modifies the deque
+        std::deque<CComplex<D, T>> complexes;
+        complexes.push_back(std::move(lastComplex_));
+        std::mutex mutex;
+        std::condition_variable changed;
+
+        std::thread producer([&, first = depth_]() {
+            for (size_t d = first; d < depth; d++) {
+                const CComplex<D, T>* last;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]() {
+                        return complexes.size() < 2 + EXPANDED_AHEAD;
+                    });
+                    last = &complexes.back();
+                }
+                CComplex<D, T> complex = last->expand();
+                complex.collapse();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    complexes.push_back(std::move(complex));
+                }
+                changed.notify_all();
+            }
+        });
+        for (; depth_ < depth; depth_++) {
+            const CComplex<D, T>* prevComplex;
+            const CComplex<D, T>* complex;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return complexes.size() >= 2; });
+                prevComplex = &complexes[0];
+                complex = &complexes[1];
+            }
+            forEachModule([&](size_t i) {
+                modules_[i]->addLevel(*prevComplex, *complex);
+            });
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                complexes.pop_front();
+            }
+            changed.notify_all();
+        }
+        producer.join();
+        lastComplex_ = std::move(complexes.front());
+    }
 
-    size_t spaceDimension_;
-};
+    size_t maxDepth_;
+    // Keys of the cells of depth maxDepth_ + 1 with some point
+    SortedKeys keys_;
+    size_t numMerged_;
+    Region<D, T> region_;
 
-template <int _N>
-std::ostream& operator<<(std::ostream& out, const Cubitos<_N>& p);
+    CComplex<D, T> lastComplex_;
+    size_t depth_;
+    std::vector<std::unique_ptr<AbstractModule>> modules_;
+};
 
 /* Debugging functions */
 #ifdef DEBUG
-template <int _N>
-std::ostream& operator<<(std::ostream& out, const Cubitos<_N>& cub) {
-    out << cub.module_;
+template <size_t D, class T>
+std::ostream& operator<<(std::ostream& out, const Cubitos<D, T>& cub) {
+    for (const auto& module : cub.modules_) {
+        module->print(out);
+    }
     return out;
 }
 #endif  // DEBUG
@@ -0,0 +1,287 @@
+#include "keys.h"
+// file: keys.cc
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <functional>
+#include <queue>
+#include <string>
+
+#include "parallel.h"
+
+using namespace cubitos;
+
+// Keys sorted by a thread at least
+static const size_t MIN_KEYS_PER_CHUNK = 4096;
+
+// Creates a temporary file in $TMPDIR, or /tmp, and unlinks it, so that it
+// is removed when closed. Returns -1 if it can't be created.
+static int temporaryFile() {
+    const char* dir = getenv("TMPDIR");
+    std::string path = std::string(dir ? dir : "/tmp") + "/cubitosXXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd >= 0) {
+        unlink(path.c_str());
+    }
+    return fd;
+}
+
+// Writes numWords words of data at the end of fd. Returns false, with errno
+// set, if they can't be written.
+static bool writeAll(int fd, const uint64_t* data, size_t numWords) {
+    const char* bytes = reinterpret_cast<const char*>(data);
+    size_t numBytes = numWords * sizeof(uint64_t);
+    while (numBytes > 0) {
+        ssize_t written = write(fd, bytes, numBytes);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            if (written == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        bytes += written;
+        numBytes -= written;
+    }
+    return true;
+}
+
+// Reads numWords words of fd, from word offset on, to data. Returns false,
+// with errno set, if they can't be read.
+static bool readAll(int fd, uint64_t* data, size_t numWords, size_t offset) {
+    char* bytes = reinterpret_cast<char*>(data);
+    size_t numBytes = numWords * sizeof(uint64_t);
+    offset *= sizeof(uint64_t);
+    while (numBytes > 0) {
+        ssize_t read = pread(fd, bytes, numBytes, offset);
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            // The file is shorter than the runs written to it
+            if (read == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        bytes += read;
+        numBytes -= read;
+        offset += read;
+    }
+    return true;
+}
+
+SortedKeys::SortedKeys(size_t keyWords, size_t memoryBudget)
+    : keyWords_(keyWords),
+      memoryBudget_(memoryBudget),
+      runsFile_(-1),
+      keysFile_(-1),
+      size_(0),
+      keys_(nullptr),
+      map_(nullptr),
+      mapSize_(0),
+      error_(0) {
+    assert(keyWords_ > 0);
+}
+
+SortedKeys::~SortedKeys() {
+    if (map_ != nullptr) {
+        munmap(map_, mapSize_);
+    }
+    if (runsFile_ >= 0) {
+        close(runsFile_);
+    }
+    if (keysFile_ >= 0) {
+        close(keysFile_);
+    }
+}
+
+size_t SortedKeys::maxBatch() const {
+    if (memoryBudget_ == 0) {
+        return SIZE_MAX / keyWords_;
+    }
+    // Sorting a run takes its keys, their order and the keys sorted
+    size_t bytesPerKey = 2 * keyWords_ * sizeof(uint64_t) + sizeof(size_t);
+    return std::max<size_t>(1, memoryBudget_ / bytesPerKey);
+}
+
+uint64_t* SortedKeys::append(size_t numKeys) {
+    assert(numKeys <= maxBatch() && keys_ == nullptr);
+    if (buffer_.size() / keyWords_ + numKeys > maxBatch() && !writeRun()) {
+        return nullptr;
+    }
+    size_t end = buffer_.size();
+    buffer_.resize(end + numKeys * keyWords_);
+    return buffer_.data() + end;
+}
+
+bool SortedKeys::sort() {
+    if (runSizes_.empty()) {
+        sortBuffer();
+        size_ = buffer_.size() / keyWords_;
+        keys_ = buffer_.data();
+        return true;
+    }
+    if (!buffer_.empty() && !writeRun()) {
+        return false;
+    }
+    std::vector<uint64_t>().swap(buffer_);
+    return mergeRuns();
+}
+
+bool SortedKeys::fail() {
+    error_ = errno;
+    return false;
+}
+
+void SortedKeys::sortBuffer() {
+    size_t numKeys = buffer_.size() / keyWords_;
+    size_t numChunks = chunksFor(numKeys, MIN_KEYS_PER_CHUNK);
+    auto key = [&](size_t i) { return buffer_.data() + i * keyWords_; };
+    if (keyWords_ == 1) {
+        parallelSort(buffer_.begin(), buffer_.end(), numChunks,
+                     std::less<uint64_t>());
+    } else {
+        // Keys of several words are sorted by their index and then moved
+        std::vector<size_t> order(numKeys);
+        for (size_t i = 0; i < numKeys; i++) {
+            order[i] = i;
+        }
+        parallelSort(order.begin(), order.end(), numChunks,
+                     [&](size_t i, size_t j) {
+                         return std::lexicographical_compare(
+                             key(i), key(i) + keyWords_, key(j),
+                             key(j) + keyWords_);
+                     });
+        std::vector<uint64_t> sorted(buffer_.size());
+        parallelChunks(numKeys, numChunks,
+                       [&](size_t, size_t begin, size_t end) {
+                           for (size_t i = begin; i < end; i++) {
+                               std::copy(key(order[i]),
+                                         key(order[i]) + keyWords_,
+                                         sorted.begin() + i * keyWords_);
+                           }
+                       });
+        buffer_.swap(sorted);
+    }
+
+    size_t numDistinct = 0;
+    for (size_t i = 0; i < numKeys; i++) {
+        if (numDistinct == 0 ||
+            !std::equal(key(i), key(i) + keyWords_, key(numDistinct - 1))) {
+            std::copy(key(i), key(i) + keyWords_, key(numDistinct));
+            numDistinct++;
+        }
+    }
+    buffer_.resize(numDistinct * keyWords_);
+}
+
+bool SortedKeys::writeRun() {
+    sortBuffer();
+    if (runsFile_ < 0 && (runsFile_ = temporaryFile()) < 0) {
+        return fail();
+    }
+    if (!writeAll(runsFile_, buffer_.data(), buffer_.size())) {
+        return fail();
+    }
+    runSizes_.push_back(buffer_.size() / keyWords_);
+    buffer_.clear();
+    return true;
+}
+
+bool SortedKeys::mergeRuns() {
+    // The budget is split into a buffer for every run and one for the
+    // merged keys
+    size_t numRuns = runSizes_.size();
+    size_t bufferKeys = std::max<size_t>(
+        1, memoryBudget_ / ((numRuns + 1) * keyWords_ * sizeof(uint64_t)));
+
+    // Keys of a run are read a buffer at a time, next is the first one not
+    // read and end the one after the run, counted from the start of the file
+    struct Run {
+        size_t next, end;
+        std::vector<uint64_t> keys;
+        size_t pos;
+    };
+    std::vector<Run> runs(numRuns);
+    for (size_t r = 0, start = 0; r < numRuns; r++) {
+        runs[r].next = start;
+        runs[r].end = start += runSizes_[r];
+    }
+    auto refill = [&](Run& run) {
+        size_t numKeys = std::min(bufferKeys, run.end - run.next);
+        run.keys.resize(numKeys * keyWords_);
+        run.next += numKeys;
+        run.pos = 0;
+        return readAll(runsFile_, run.keys.data(), run.keys.size(),
+                       (run.next - numKeys) * keyWords_);
+    };
+    auto current = [&](size_t r) {
+        return runs[r].keys.data() + runs[r].pos * keyWords_;
+    };
+    // The run with the lowest current key is on top
+    auto greater = [&](size_t r, size_t s) {
+        return std::lexicographical_compare(
+            current(s), current(s) + keyWords_, current(r),
+            current(r) + keyWords_);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(
+        greater);
+    for (size_t r = 0; r < numRuns; r++) {
+        if (!refill(runs[r])) {
+            return fail();
+        }
+        heap.push(r);
+    }
+
+    if ((keysFile_ = temporaryFile()) < 0) {
+        return fail();
+    }
+    std::vector<uint64_t> merged, last(keyWords_);
+    merged.reserve(bufferKeys * keyWords_);
+    while (!heap.empty()) {
+        size_t r = heap.top();
+        heap.pop();
+        const uint64_t* key = current(r);
+        if (size_ == 0 || !std::equal(key, key + keyWords_, last.begin())) {
+            merged.insert(merged.end(), key, key + keyWords_);
+            std::copy(key, key + keyWords_, last.begin());
+            size_++;
+            if (merged.size() == bufferKeys * keyWords_) {
+                if (!writeAll(keysFile_, merged.data(), merged.size())) {
+                    return fail();
+                }
+                merged.clear();
+            }
+        }
+        Run& run = runs[r];
+        if (++run.pos * keyWords_ == run.keys.size() && !refill(run)) {
+            return fail();
+        }
+        if (!run.keys.empty()) {
+            heap.push(r);
+        }
+    }
+    if (!writeAll(keysFile_, merged.data(), merged.size())) {
+        return fail();
+    }
+    close(runsFile_);
+    runsFile_ = -1;
+
+    mapSize_ = size_ * keyWords_ * sizeof(uint64_t);
+    void* map = mmap(nullptr, mapSize_, PROT_READ, MAP_SHARED, keysFile_, 0);
+    if (map == MAP_FAILED) {
+        return fail();
+    }
+    map_ = map;
+    keys_ = static_cast<const uint64_t*>(map_);
+    return true;
+}
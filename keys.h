@@ -0,0 +1,72 @@
+#pragma once
+// file: keys.h
+// description: sorted array of Morton keys, sorted in memory or out of core
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cubitos {
+
+// Sorted array of distinct keys of keyWords() 64-bit words each, compared
+// word by word. Keys are appended in any order and sorted by sort().
+// Without a memory budget they are sorted in memory. With one, keys are
+// kept in memory until they fill it, then sorted into a run of a temporary
+// file, and sort() merges the runs into another temporary file which is
+// mapped in memory, so that the keys in memory stay within the budget
+// however many there are. Failures to write, read or map the temporary
+// files are returned, with their errno kept in error().
+class SortedKeys {
+   public:
+    // Keeps all the keys in memory if memoryBudget is 0, or about
+    // memoryBudget bytes of them otherwise
+    // Pre: keyWords > 0
+    SortedKeys(size_t keyWords, size_t memoryBudget = 0);
+    ~SortedKeys();
+    SortedKeys(const SortedKeys&) = delete;
+    SortedKeys& operator=(const SortedKeys&) = delete;
+
+    // Number of keys that can be appended at once
+    size_t maxBatch() const;
+    // Returns where to write numKeys keys, which are added to the array, or
+    // nullptr if the keys before them can't be written to a run
+    // Pre: numKeys <= maxBatch() and sort() was not called
+    uint64_t* append(size_t numKeys);
+    // Sorts the keys appended and removes their repetitions. Returns false
+    // if the runs can't be merged.
+    bool sort();
+    // The errno of the failure of append() or sort(), or 0 if none failed
+    int error() const { return error_; }
+
+    size_t keyWords() const { return keyWords_; }
+    // Pre: sort() was called
+    size_t size() const { return size_; }
+    const uint64_t* data() const { return keys_; }
+
+   private:
+    // Sorts the keys in buffer_ and removes their repetitions
+    void sortBuffer();
+    // Sorts the keys in buffer_ into a new run of the runs file
+    bool writeRun();
+    // Merges the runs into a new file, mapped as the sorted keys
+    bool mergeRuns();
+    // Keeps errno as the error and returns false
+    bool fail();
+
+    size_t keyWords_, memoryBudget_;
+    // Keys appended and not yet written to a run
+    std::vector<uint64_t> buffer_;
+    // Temporary files, already unlinked, of the runs and of the merged keys
+    int runsFile_, keysFile_;
+    // Number of keys of every run, written one after the other
+    std::vector<size_t> runSizes_;
+
+    size_t size_;
+    // Sorted keys, either in buffer_ or in the merged file mapped
+    const uint64_t* keys_;
+    void* map_;
+    size_t mapSize_;
+    int error_;
+};
+
+}  // namespace cubitos
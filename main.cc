@@ -1,66 +1,187 @@
 #include <cassert>
-#include <fstream>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <limits>
 
 #include "cubitos.h"
 
 using namespace std;
 
-vector<vector<float>> readFile(const string& filename) {
-    vector<vector<float>> points;
-    ifstream file(filename);
-    string line;
-
-    while (getline(file, line)) {
-        stringstream ss(line);
-        vector<float> point;
-        float value;
+// Parses a decimal number which takes all of text into value, returns false
+// if text is empty, has anything else or the number is out of range
+bool readNumber(const string& text, unsigned long& value) {
+    // strtoul would skip blanks and accept a sign
+    if (text.empty() || !isdigit((unsigned char)text[0])) {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    value = strtoul(text.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
 
-        while (ss >> value) {
-            point.push_back(value);
+// Parses a comma separated list of primes, returns false if any of them is
+// not a number above 1 or has no precompiled module
+bool readPrimes(const string& list, vector<size_t>& primes) {
+    primes.clear();
+    for (size_t begin = 0; begin <= list.size();) {
+        size_t end = min(list.find(',', begin), list.size());
+        unsigned long prime;
+        if (!readNumber(list.substr(begin, end - begin), prime) || prime < 2) {
+            return false;
         }
-
-        points.push_back(point);
+        primes.push_back(prime);
+        bool supported = false;
+        for (const auto& factory : cubitos::MODULE_FACTORIES) {
+            supported = supported || factory.first == primes.back();
+        }
+        if (!supported) {
+            return false;
+        }
+        begin = end + 1;
     }
+    return !primes.empty();
+}
 
-    return points;
+// Computes the barcodes of a cloud of points with coordinates of type T up
+// to depth into barcodes, sorting it out of core within memoryBudget bytes
+// if not 0, or sets sortError to the errno if that fails. Points in the same
+// cell of the last depth looked at are merged, how many is reported. Returns
+// false if its dimension is not supported
+template <class T>
+bool computeBarcodes(const cubitos::PointCloud& points,
+                     const vector<size_t>& primes, size_t depth,
+                     size_t memoryBudget, vector<cubitos::Barcode>& barcodes,
+                     int& sortError) {
+    switch (points.dim()) {
+#define DISPATCH_DIM(D, T)                                                    \
+    case D: {                                                                 \
+        auto p = cubitos::Cubitos<D, T>(points, depth, primes, memoryBudget); \
+        sortError = p.error();                                                \
+        if (sortError != 0) {                                                 \
+            return true;                                                      \
+        }                                                                     \
+        if (p.numMerged() > 0) {                                              \
+            cerr << "Merged " << p.numMerged() << " of " << points.size()     \
+                 << " points sharing a cell of depth " << depth + 1           \
+                 << " with another one" << endl;                              \
+        }                                                                     \
+        p.addToLevel(depth);                                                  \
+        barcodes = p.barcodes();                                              \
+        return true;                                                          \
+    }
+        FOR_EACH_DIM(DISPATCH_DIM, T)
+#undef DISPATCH_DIM
+        default:
+            return false;
+    }
 }
 
 int main(int argc, char* argv[]) {
     enum FLAG { UNSET = 0, SET };
     FLAG tikz = UNSET;
+    FLAG badPrimes = UNSET;
+    FLAG badBudget = UNSET;
+    vector<size_t> primes = {11};
+    size_t memoryBudget = 0;
     string param;
     int param_i;
 
+    // cubitos convert <filename> <npy filename> rewrites a cloud as a .npy
+    // array of float32, which is then read without parsing nor copying it
+    if (argc == 4 && string(argv[1]) == "convert") {
+        cubitos::PointCloud cloud;
+        if (!cloud.read(argv[2]) || !cloud.writeNpy(argv[3])) {
+            cerr << "Can't convert " << argv[2] << " to " << argv[3] << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     // Dirty arg handling
     for (param_i = 1; param_i < argc;) {
         param = argv[param_i];
         if (param == "-t") {
             tikz = SET;
             param_i++;
-            break;
+        } else if (param == "-p" && param_i + 1 < argc) {
+            badPrimes = readPrimes(argv[param_i + 1], primes) ? UNSET : SET;
+            param_i += 2;
+        } else if (param == "-m" && param_i + 1 < argc) {
+            // A budget of 0 would mean sorting in memory, and one above
+            // SIZE_MAX bytes would wrap
+            unsigned long mebibytes;
+            bool valid = readNumber(argv[param_i + 1], mebibytes) &&
+                         mebibytes > 0 && mebibytes <= SIZE_MAX >> 20;
+            badBudget = valid ? UNSET : SET;
+            memoryBudget = valid ? mebibytes << 20 : 0;
+            param_i += 2;
         } else {
             break;
         }
     }
-    if (argc - param_i != 2) {
+    if (argc - param_i != 2 || badPrimes || badBudget) {
         cerr << "Use:" << endl
              << argv[0] << " [flags] <filename> <max_depth>" << endl
-             << "\t-t tikz output" << endl;
+             << "\t-t tikz output" << endl
+             << "\t-p <p1,p2,...> compute with Z/p coefficients for each"
+             << " prime, concurrently (default 11). Available primes:";
+        for (const auto& factory : cubitos::MODULE_FACTORIES) {
+            cerr << ' ' << factory.first;
+        }
+        cerr << endl
+             << "\t-m <MiB> sort the cloud out of core, in temporary files,"
+             << " keeping about MiB mebibytes of it in memory" << endl
+             << argv[0] << " convert <filename> <npy filename>" << endl
+             << "\twrites the cloud as a .npy array of float32" << endl;
         return 1;
     }
 
-    vector<vector<float>> v = readFile(argv[param_i++]);
-    int depth = stoi(argv[param_i]);
-
-    auto p = cubitos::Cubitos<11>(v);
+    cubitos::PointCloud v;
+    if (!v.read(argv[param_i])) {
+        cerr << "Can't read a point cloud from " << argv[param_i] << endl;
+        return 1;
+    }
+    int depth = stoi(argv[param_i + 1]);
 
-    p.addToLevel(depth);
-    if (tikz) {
-        cout << p.barcode().tikzbarcode() << std::endl;
-    } else {
-        cout << p.barcode() << std::endl;
+    // The pipeline is compiled for each supported dimension and coordinate
+    // type, the smallest type with room for the depth is used
+    vector<cubitos::Barcode> barcodes;
+    size_t dim = v.size() == 0 ? 0 : v.dim();
+    bool supported = false, computed = false;
+    int sortError = 0;
+#define DISPATCH_COOR(T)                                               \
+    if (!computed && dim > 0 && depth >= 0 &&                          \
+        depth + 2 <= numeric_limits<T>::digits) {                      \
+        supported = computeBarcodes<T>(v, primes, depth, memoryBudget, \
+                                       barcodes, sortError);           \
+        computed = true;                                               \
+    }
+    FOR_EACH_COOR(DISPATCH_COOR)
+#undef DISPATCH_COOR
+    if (sortError != 0) {
+        cerr << "Can't sort " << argv[param_i]
+             << " out of core: " << strerror(sortError) << endl;
+        return 1;
+    }
+    if (!supported) {
+        cerr << "Points of dimension " << dim << " up to depth " << depth
+             << " are not supported" << endl;
+        return 1;
+    }
+    for (size_t i = 0; i < primes.size(); i++) {
+        if (primes.size() > 1) {
+            cout << "Z/" << primes[i] << ':' << endl;
+        }
+        if (tikz) {
+            cout << barcodes[i].tikzbarcode() << std::endl;
+        } else {
+            cout << barcodes[i] << std::endl;
+        }
     }
 
     return 0;
@@ -3,6 +3,7 @@
 // description: Code for a persistent module
 
 #include <cassert>
+#include <memory>
 #include <vector>
 
 #include "algorithms/reductions.h"
@@ -12,37 +13,59 @@
 
 namespace cubitos {
 
+// Field independent interface of a persistent module, so that modules over
+// different primes can be fed with the same sequence of complexes
+class AbstractModule {
+   public:
+    virtual ~AbstractModule() {}
+
+    // Expands the module with the next complex of the sequence
+    // Pre: complex is the expansion of prevComplex, the last one added
+    virtual void addLevel(const AbstractComplex& prevComplex,
+                          const AbstractComplex& complex) = 0;
+
+    // Computes the barcode of all the levels added
+    virtual Barcode computeBarcode() = 0;
+
+#ifdef DEBUG
+    virtual std::ostream& print(std::ostream& out) const = 0;
+#endif  // DEBUG
+};
+
 template <size_t _N>
-class Module {
+class Module : public AbstractModule {
    public:
     Module() {}
-    Module(const CComplex& complex) : lastComplex_(complex), maxDim_(0) {
-        Dim dim = {// No basis changes for collapses
-                   .R = SMatrix<_N>::identity(1),
-                   .R_inv = SMatrix<_N>::identity(1),
-                   // The trivial empty collapse map
-                   .inducedMap = SMatrix<_N>(1, 1),
-                   .firstHomologyIndex = 0};
+    // Starts the module with the depth 0 complex
+    Module(const AbstractComplex& complex)
+        : lastBases_(homologyBases(complex)), maxDim_(0) {
+        // The trivial empty collapse map
+        Dim dim = {.inducedMap = SMatrix<_N>(1, 1)};
         Depth depth = {{dim}};
         depths_.push_back(depth);
     }
 
     // Returns the boundary matrix d_dim
-    SMatrix<_N> diffMat(const CComplex& complex, size_t dim) const {
+    SMatrix<_N> diffMat(const AbstractComplex& complex, size_t dim) const {
         assert(dim > 0);
         SMatrix<_N> mat(complex.numSimplicesIn(dim - 1),
                         complex.numSimplicesIn(dim));
 
-        for (auto& elm : complex.getDifferentialMap(dim)) {
-            mat.insert(elm.first.second, elm.first.first, elm.second);
+        const auto& diffMap = complex.getDifferentialMap(dim);
+        for (size_t j = 0; j + 1 < diffMap.colStart.size(); j++) {
+            for (size_t k = diffMap.colStart[j]; k < diffMap.colStart[j + 1];
+                 k++) {
+                mat.insert(diffMap.rows[k], j, diffMap.values[k]);
+            }
         }
 
         return mat;
     }
 
     // Returns the boundary matrix M_dim: domain -> image
-    SMatrix<_N> getCollapsingMatrix(const CComplex& domain,
-                                    const CComplex& image, size_t dim) const {
+    SMatrix<_N> getCollapsingMatrix(const AbstractComplex& domain,
+                                    const AbstractComplex& image,
+                                    size_t dim) const {
         assert(dim >= 0);
 
         if (domain.numSimplicesIn(dim) == 0) {
@@ -52,8 +75,11 @@ class Module {
         imageSize = (imageSize > 0) ? imageSize : 1;
 
         SMatrix<_N> mat(imageSize, domain.numSimplicesIn(dim));
-        for (const auto& elm : domain.getCollapsingMap(dim)) {
-            mat.insert(elm.second, elm.first, 1);
+        const auto& collapsingMap = domain.getCollapsingMap(dim);
+        for (size_t j = 0; j < collapsingMap.size(); j++) {
+            if (collapsingMap[j] != AbstractComplex::NO_PARENT) {
+                mat.insert(collapsingMap[j], j, 1);
+            }
         }
 
         return mat;
@@ -68,93 +94,92 @@ class Module {
         return depths_[depth].dimensions[dim].inducedMap;
     }
 
-    inline void addToLevel(size_t depth) {
-        while (depths_.size() <= depth) {
-            addLevel();
+    // Computes the homology basis of every dimension of complex. Dimensions
+    // are reduced from the top down, so that the lows of d_{k+1} clear the
+    // columns of d_k before reducing it.
+    std::vector<HomologyBasis<_N>> homologyBases(
+        const AbstractComplex& complex) const {
+        std::vector<HomologyBasis<_N>> bases(complex.dim_ + 1);
+        std::vector<bool> clear(complex.numSimplicesIn(complex.dim_), false);
+        bases[complex.dim_].boundaryWithLow.assign(clear.size(), NO_COLUMN);
+
+        for (size_t dim = complex.dim_; dim > 0; dim--) {
+            SMatrix<_N> A = diffMat(complex, dim);
+            SMatrix<_N> V = SMatrix<_N>::identity(A.coldim());
+            auto lows = reduceBoundary(A, V, clear);
+
+            // Zero columns which were not cleared are the essential cycles
+            std::vector<size_t> essential;
+            for (size_t j = 0; j < lows.size(); j++) {
+                if (lows[j] == NO_COLUMN && !clear[j]) {
+                    essential.push_back(j);
+                }
+            }
+            setEssentialCycles(bases[dim], V, essential);
+
+            auto& lower = bases[dim - 1];
+            clear.assign(A.rowdim(), false);
+            lower.boundaryWithLow.assign(A.rowdim(), NO_COLUMN);
+            for (size_t j = 0; j < lows.size(); j++) {
+                if (lows[j] != NO_COLUMN) {
+                    clear[lows[j]] = true;
+                    lower.boundaryWithLow[lows[j]] = j;
+                }
+            }
+            lower.boundaries = std::move(A);
+        }
+
+        // Every 0-simplex is a cycle
+        std::vector<size_t> essential;
+        for (size_t j = 0; j < clear.size(); j++) {
+            if (!clear[j]) {
+                essential.push_back(j);
+            }
         }
+        setEssentialCycles(bases[0], SMatrix<_N>::identity(clear.size()),
+                           essential);
+        return bases;
     }
 
     // Expands the module to a greater depth using Algorithm 1
-    void addLevel() {
-        Dim dimension;
+    void addLevel(const AbstractComplex& prevComplex,
+                  const AbstractComplex& complex) override {
         Depth currentDepth;
 
-        CComplex prevComplex = lastComplex_;
-        lastComplex_ = lastComplex_.expand();
-        maxDim_ = std::max(maxDim_, lastComplex_.dim_);
-        auto& complex = lastComplex_;
+        maxDim_ = std::max(maxDim_, complex.dim_);
 
-        size_t firstHomologyIndex;
+        auto bases = homologyBases(complex);
 
-        SMatrix<_N> A, B, R, R_inv;
-
-        if (complex.dim_ > 0) {
-            A = diffMat(complex, 1);
-            rowReduce(A, R, R_inv, firstHomologyIndex);
-            dimension = {.R = R_inv,
-                         .R_inv = R,
-                         .firstHomologyIndex = firstHomologyIndex};
-            currentDepth.dimensions.push_back(dimension);
-
-            B = A;
-            for (size_t dim = 1; dim < complex.dim_; dim++) {
-                A = diffMat(complex, dim + 1);
-                simultaneousReduce(B, A, R, R_inv, firstHomologyIndex);
-
-                dimension = {.R = R,
-                             .R_inv = R_inv,
-                             .firstHomologyIndex = firstHomologyIndex};
-                currentDepth.dimensions.push_back(dimension);
-                B = A;
-            }
-
-            B = diffMat(complex, complex.dim_);
-            columnReduce(B, R, R_inv, firstHomologyIndex);
-            dimension = {.R = R,
-                         .R_inv = R_inv,
-                         .firstHomologyIndex = firstHomologyIndex};
-            currentDepth.dimensions.push_back(dimension);
-        } else {  // All simplices are in the homology group, i.e. trivial
-                  // case 0 <- C_0 <- 0
-            dimension = {
-                .R = SMatrix<_N>::identity(complex.numSimplicesIn(0)),
-                .R_inv = SMatrix<_N>::identity(complex.numSimplicesIn(0)),
-                .firstHomologyIndex = 0};
-            currentDepth.dimensions.push_back(dimension);
-        }
-
-        for (size_t dim = 0; dim < currentDepth.dimensions.size(); dim++) {
+        for (size_t dim = 0; dim < bases.size(); dim++) {
+            Dim dimension;
+            size_t numHomology = bases[dim].cycles.coldim();
             auto matrix_map = getCollapsingMatrix(complex, prevComplex, dim);
-            if (currentDepth.dimensions[dim].firstHomologyIndex ==
-                    complex.numSimplicesIn(dim) ||
-                matrix_map.isNull()) {
+            if (numHomology == 0 || matrix_map.isNull()) {
                 // The domain and image spaces are emptysets. Even though
                 // it would be (0), we store it as null
-                currentDepth.dimensions[dim].inducedMap =
-                    SMatrix<_N>::zeroMatrix();
-            } else if (dim >= depths_.back().dimensions.size() ||
-                       depths_.back().dimensions[dim].firstHomologyIndex ==
-                           prevComplex.numSimplicesIn(dim)) {
+                dimension.inducedMap = SMatrix<_N>::zeroMatrix();
+            } else if (dim >= lastBases_.size() ||
+                       lastBases_[dim].cycles.coldim() == 0) {
                 // The image space is emptyset, so we want a matrix with
                 // a single row of zeroes
-                currentDepth.dimensions[dim].inducedMap = SMatrix<_N>(
-                    1, complex.numSimplicesIn(dim) -
-                           currentDepth.dimensions[dim].firstHomologyIndex);
+                dimension.inducedMap = SMatrix<_N>(1, numHomology);
             } else {
-                // The complete calculation for the induced map
-                matrix_map.rightMulIn(currentDepth.dimensions[dim].R);
-                matrix_map.leftMulIn(depths_.back().dimensions[dim].R_inv);
-                currentDepth.dimensions[dim].inducedMap = matrix_map.submatrix(
-                    depths_.back().dimensions[dim].firstHomologyIndex,
-                    currentDepth.dimensions[dim].firstHomologyIndex);
+                // The collapse of the essential cycles, written in the
+                // homology basis of the previous depth
+                matrix_map.rightMulIn(bases[dim].cycles);
+                dimension.inducedMap =
+                    homologyCoordinates(matrix_map, lastBases_[dim]);
             }
+            currentDepth.dimensions.push_back(dimension);
         }
 
         depths_.push_back(currentDepth);
+        // Only the bases of the last depth are needed for the next one
+        lastBases_ = std::move(bases);
     }
 
     // Computes the barcode using Algorithm 2
-    Barcode computeBarcode() {
+    Barcode computeBarcode() override {
         Barcode bcode;
         int n = depths_.size();
 
@@ -222,20 +247,51 @@ class Module {
         }
         return out;
     }
+
+    std::ostream& print(std::ostream& out) const override {
+        return out << *this;
+    }
 #endif  // DEBUG
 
    private:
     struct Dim {
-        SMatrix<_N> R, R_inv;
         SMatrix<_N> inducedMap;
-        size_t firstHomologyIndex;
     };
     struct Depth {
         std::vector<Dim> dimensions;
     };
     std::vector<Depth> depths_;
-    CComplex lastComplex_;
+    std::vector<HomologyBasis<_N>> lastBases_;
     size_t maxDim_;
 };
 
+template <size_t _N>
+std::unique_ptr<AbstractModule> newModule(const AbstractComplex& complex) {
+    return std::unique_ptr<AbstractModule>(new Module<_N>(complex));
+}
+
+typedef std::unique_ptr<AbstractModule> (*ModuleFactory)(
+    const AbstractComplex&);
+
+// Primes with a precompiled module
+static const std::pair<size_t, ModuleFactory> MODULE_FACTORIES[] = {
+    {2, newModule<2>},
+    {3, newModule<3>},
+    {5, newModule<5>},
+    {7, newModule<7>},
+    {11, newModule<11>},
+    {LARGE_PRIME, newModule<LARGE_PRIME>}};
+
+// Returns a module over Z/prime starting with complex, or nullptr if there
+// is no precompiled module for prime
+inline std::unique_ptr<AbstractModule> makeModule(
+    size_t prime, const AbstractComplex& complex) {
+    for (const auto& factory : MODULE_FACTORIES) {
+        if (factory.first == prime) {
+            return factory.second(complex);
+        }
+    }
+    return nullptr;
+}
+
 }  // namespace cubitos
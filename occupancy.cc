@@ -0,0 +1,73 @@
+#include "occupancy.h"
+// file: occupancy.cc
+
+#include <cassert>
+#include <limits>
+
+using namespace cubitos;
+
+template <size_t D, class T>
+const T OccupancyCache<D, T>::EMPTY;
+
+template <size_t D, class T>
+OccupancyCache<D, T>::OccupancyCache(const Region<D, T>& region, size_t depth)
+    : depth_(depth) {
+    const size_t numBits = Point<D, T>::NUMBITS;
+    assert(depth_ < numBits);
+    T allOnes = std::numeric_limits<T>::max();
+    mask_ = depth_ == 0 ? 0 : allOnes >> (numBits - depth_)
+                                  << (numBits - depth_);
+
+    // The keys of a cell are consecutive, so its first key is the one
+    // whose prefix differs from the previous key. They are counted first to
+    // size the table, at most half of whose slots are used.
+    size_t bits = D * depth_;
+    auto isFirstOfCell = [&region, bits](size_t k) {
+        return k == 0 ||
+               !Region<D, T>::equalPrefix(region.keyAt(k - 1),
+                                          region.keyAt(k), bits);
+    };
+    size_t numCells = 0;
+    for (size_t k = 0; k < region.numKeys_; k++) {
+        numCells += isFirstOfCell(k);
+    }
+    logSlots_ = 1;
+    while ((size_t(1) << logSlots_) < 2 * numCells) {
+        logSlots_++;
+    }
+    slotMask_ = (size_t(1) << logSlots_) - 1;
+    std::array<T, D> empty;
+    empty.fill(EMPTY);
+    slots_.assign(slotMask_ + 1, empty);
+    for (size_t k = 0; k < region.numKeys_; k++) {
+        if (!isFirstOfCell(k)) {
+            continue;
+        }
+        std::array<T, D> cell = cellOf(region.keyAt(k), bits);
+        size_t slot = slotOf(cell);
+        while (slots_[slot][0] != EMPTY) {
+            slot = (slot + 1) & slotMask_;
+        }
+        slots_[slot] = cell;
+    }
+}
+
+template <size_t D, class T>
+std::array<T, D> OccupancyCache<D, T>::cellOf(const uint64_t* key,
+                                              size_t bits) {
+    // Bit b of a key is bit b / D of coordinate b % D, from the most
+    // significant one
+    std::array<T, D> cell;
+    cell.fill(0);
+    for (size_t b = 0; b < bits; b++) {
+        if (key[b / 64] >> (63 - b % 64) & 1) {
+            cell[b % D] |= Point<D, T>::BIGONE >> (b / D);
+        }
+    }
+    return cell;
+}
+
+#define INSTANTIATE_OCCUPANCY(D, T) \
+    template class cubitos::OccupancyCache<D, T>;
+#define INSTANTIATE_OCCUPANCIES(T) FOR_EACH_DIM(INSTANTIATE_OCCUPANCY, T)
+FOR_EACH_COOR(INSTANTIATE_OCCUPANCIES)
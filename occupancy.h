@@ -0,0 +1,68 @@
+#pragma once
+// file: occupancy.h
+// description: set of the cells of one depth with some point of a region,
+//              to test the vertices of the simplices of an expansion
+
+#include <vector>
+
+#include "point.h"
+#include "region.h"
+
+namespace cubitos {
+
+// Cells of depth <depth> with some point of a region, in a flat open
+// addressing hash table of their truncated coordinates. It is built once for
+// every expansion, whose vertices are all looked up in cells of the same
+// depth, so looking for points around a vertex is a hash and a few probes
+// instead of a search in the region. It is not modified after built, so it
+// can be shared among threads.
+template <size_t D, class T>
+class OccupancyCache {
+   public:
+    // Pre: depth <= region.maxDepth() and depth < Point<D, T>::NUMBITS
+    OccupancyCache(const Region<D, T>& region, size_t depth);
+
+    // Whether there is a point of the region in the cell of depth() which
+    // contains p
+    inline bool contains(const Point<D, T>& p) const {
+        std::array<T, D> cell;
+        for (size_t i = 0; i < D; i++) {
+            cell[i] = p.coors_[i] & mask_;
+        }
+        for (size_t slot = slotOf(cell);; slot = (slot + 1) & slotMask_) {
+            if (slots_[slot] == cell) {
+                return true;
+            }
+            if (slots_[slot][0] == EMPTY) {
+                return false;
+            }
+        }
+    }
+
+    size_t depth() const { return depth_; }
+
+   private:
+    // Truncated coordinates have their last bit unset, so this marks the
+    // empty slots
+    static const T EMPTY = 1;
+
+    // Returns the coordinates of the cell whose Morton key begins with the
+    // first bits of key
+    static std::array<T, D> cellOf(const uint64_t* key, size_t bits);
+
+    inline size_t slotOf(const std::array<T, D>& cell) const {
+        uint64_t hash = 0;
+        for (auto x : cell) {
+            hash = (hash ^ x) * 0x9e3779b97f4a7c15;
+        }
+        return hash >> (64 - logSlots_);
+    }
+
+    size_t depth_;
+    // Keeps the first depth_ bits of a coordinate
+    T mask_;
+    size_t logSlots_, slotMask_;
+    std::vector<std::array<T, D>> slots_;
+};
+
+}  // namespace cubitos
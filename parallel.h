@@ -0,0 +1,75 @@
+#pragma once
+// file: parallel.h
+// description: helpers to split work among threads
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace cubitos {
+
+// Returns the number of threads the hardware runs concurrently
+inline size_t numThreads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Returns how many chunks to split work units into for parallelChunks: one
+// per thread, but fewer if they would get less than minPerChunk units each,
+// since smaller chunks cost more to start than they save
+inline size_t chunksFor(size_t work, size_t minPerChunk) {
+    return std::min(numThreads(), 1 + work / minPerChunk);
+}
+
+// Splits [0, n) into numChunks contiguous chunks of similar size and calls
+// f(chunk, begin, end) for each of them, concurrently if there are several.
+// Chunks are numbered in order, so per chunk results can be merged in the
+// same order a serial loop would produce them.
+template <class F>
+void parallelChunks(size_t n, size_t numChunks, F f) {
+    if (numChunks <= 1) {
+        f(0, 0, n);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (size_t chunk = 0; chunk < numChunks; chunk++) {
+        workers.emplace_back(f, chunk, n * chunk / numChunks,
+                             n * (chunk + 1) / numChunks);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Sorts [begin, end) with comp, sorting numChunks chunks concurrently and
+// then merging pairs of consecutive chunks until one is left
+template <class It, class Compare>
+void parallelSort(It begin, It end, size_t numChunks, Compare comp) {
+    size_t n = end - begin;
+    std::vector<size_t> bounds;
+    for (size_t chunk = 0; chunk <= numChunks; chunk++) {
+        bounds.push_back(n * chunk / numChunks);
+    }
+    parallelChunks(n, numChunks, [&](size_t chunk, size_t, size_t) {
+        std::sort(begin + bounds[chunk], begin + bounds[chunk + 1], comp);
+    });
+    while (bounds.size() > 2) {
+        size_t numMerges = (bounds.size() - 1) / 2;
+        parallelChunks(numMerges, numMerges,
+                       [&](size_t merge, size_t, size_t) {
+                           std::inplace_merge(begin + bounds[2 * merge],
+                                              begin + bounds[2 * merge + 1],
+                                              begin + bounds[2 * merge + 2],
+                                              comp);
+                       });
+        std::vector<size_t> merged;
+        for (size_t i = 0; i < bounds.size(); i += 2) {
+            merged.push_back(bounds[i]);
+        }
+        if (merged.back() != n) {
+            merged.push_back(n);
+        }
+        bounds.swap(merged);
+    }
+}
+
+}  // namespace cubitos
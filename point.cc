@@ -1,102 +1,138 @@
 #include "point.h"
 // file: point.cc
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 using namespace cubitos;
 
-Point::Point() {}
+template <size_t D, class T>
+Point<D, T>::Point() {}
 
-Point::Point(std::vector<std::bitset<NUMBITS>> coors) : coors_(coors) {
-    dim_ = coors_.size();
-}
+template <size_t D, class T>
+Point<D, T>::Point(const std::array<T, D>& coors) : coors_(coors) {}
 
-Point::Point(std::vector<float> coors) {
-    for (auto x : coors) {
-        coors_.push_back(
-            std::bitset<NUMBITS>((x * (float)ALLONES.to_ullong())));
+template <size_t D, class T>
+Point<D, T>::Point(const float* coors) {
+    for (size_t i = 0; i < D; i++) {
+        // The first bits of the 64 bits coordinate, so that every type
+        // truncates the same point
+        auto coor = (unsigned long long)(coors[i] * (float)UINT64_MAX);
+        coors_[i] = coor >> (64 - NUMBITS);
     }
-    dim_ = coors_.size();
 }
 
-bool Point::operator<(const Point& rp) const {
-    for (ssize_t j = NUMBITS - 1; j >= 0; j--) {
-        for (size_t i = 0; i < coors_.size(); i++) {
-            if ((coors_[i][j] == 0) && (rp.coors_[i][j] == 1)) {
-                return true;
-            } else if ((coors_[i][j] == 1) && (rp.coors_[i][j] == 0)) {
-                return false;
+// Returns the mask with a bit every dim bits, from the lowest one
+static inline uint64_t spreadMask(size_t dim) {
+    static const auto masks = []() {
+        std::array<uint64_t, 65> masks = {0};
+        for (size_t dim = 1; dim <= 64; dim++) {
+            for (size_t bit = 0; bit < 64; bit += dim) {
+                masks[dim] |= 1ULL << bit;
             }
         }
-    }
-    return false;
+        return masks;
+    }();
+    return masks[dim];
 }
 
-bool Point::operator==(const Point& rhs) const {
-    if (dim_ != rhs.dim_) {
-        return false;
+// Moves bit k of x to bit k * dim, for the 64 / dim lowest bits of x
+static inline uint64_t spreadBits(uint64_t x, size_t dim) {
+#ifdef __BMI2__
+    return _pdep_u64(x, spreadMask(dim));
+#else
+    switch (dim) {
+        case 1:
+            return x;
+        case 2:
+            x &= 0x00000000FFFFFFFF;
+            x = (x | (x << 16)) & 0x0000FFFF0000FFFF;
+            x = (x | (x << 8)) & 0x00FF00FF00FF00FF;
+            x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0F;
+            x = (x | (x << 2)) & 0x3333333333333333;
+            return (x | (x << 1)) & 0x5555555555555555;
+        case 3:
+            x &= 0x00000000001FFFFF;
+            x = (x | (x << 32)) & 0x001F00000000FFFF;
+            x = (x | (x << 16)) & 0x001F0000FF0000FF;
+            x = (x | (x << 8)) & 0x100F00F00F00F00F;
+            x = (x | (x << 4)) & 0x10C30C30C30C30C3;
+            return (x | (x << 2)) & 0x1249249249249249;
+        case 4:
+            return spreadBits(spreadBits(x & 0xFFFF, 2), 2);
+        default:
+            uint64_t spread = 0;
+            for (size_t k = 0; k < 64 / dim; k++) {
+                spread |= ((x >> k) & 1) << (k * dim);
+            }
+            return spread;
     }
-    for (size_t i = 0; i < dim_; i++) {
-        if (coors_[i] != rhs.coors_[i]) {
-            return false;
+#endif  // __BMI2__
+}
+
+template <size_t D, class T>
+void Point<D, T>::mortonKey(size_t levels, uint64_t* key) const {
+    std::fill(key, key + (D * levels + 63) / 64, 0);
+    // Levels are interleaved in groups that fill a word
+    size_t groupLevels = 64 / D;
+    for (size_t level = 0, bit = 0; level < levels; level += groupLevels) {
+        size_t numLevels = std::min(groupLevels, levels - level);
+        size_t numBits = numLevels * D;
+        uint64_t group = 0;
+        for (size_t i = 0; i < D; i++) {
+            uint64_t coor = (uint64_t)coors_[i] << (64 - NUMBITS);
+            group |= spreadBits((coor << level) >> (64 - numLevels), D)
+                     << (D - 1 - i);
+        }
+        // Appends the numBits of group to the key
+        uint64_t aligned = group << (64 - numBits);
+        key[bit / 64] |= aligned >> (bit % 64);
+        if (bit % 64 + numBits > 64) {
+            key[bit / 64 + 1] |= aligned << (64 - bit % 64);
         }
+        bit += numBits;
     }
-    return true;
 }
 
-bool Point::operator!=(const Point& rhs) const { return !(*this == rhs); }
-
-Point Point::truncate(size_t n) const {
-    std::vector<std::bitset<NUMBITS>> coors;
-    for (auto x : coors_) {
-        coors.push_back(x >> (NUMBITS - n) << (NUMBITS - n));
-    }
-    return Point(coors);
+template <size_t D, class T>
+bool Point<D, T>::operator==(const Point<D, T>& rhs) const {
+    return coors_ == rhs.coors_;
 }
 
-bool Point::equalsTruncated(const Point& rhs, size_t depth) const {
-    auto x = coors_.begin();
-    auto y = rhs.coors_.begin();
-    size_t shift = NUMBITS - depth;
-    while (x != coors_.end()) {
-        if ((*x >> shift << shift) != *y) {
-            return false;
-        }
-        x++;
-        y++;
-    }
-    return true;
+template <size_t D, class T>
+bool Point<D, T>::operator!=(const Point<D, T>& rhs) const {
+    return !(*this == rhs);
 }
 
-void Point::directions(size_t depth, std::vector<int>& directions,
-                       std::vector<int>& nondirections) const {
-    std::bitset<NUMBITS> oneOne = (BIGONE >> depth);
-    for (size_t i = 0; i < coors_.size(); i++) {
-        if ((coors_[i] & oneOne) == 0) {
-            directions.push_back(i);
-        } else {
-            nondirections.push_back(i);
-        }
+template <size_t D, class T>
+size_t PointHash<D, T>::operator()(const Point<D, T>& point) const {
+    size_t seed = 0;
+    for (auto x : point.coors_) {
+        seed ^= x + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2);
     }
+    return seed;
 }
 
-// Pre: It's a center
-size_t Point::depthAsCenter() const {
-    for (int i = 0; i < NUMBITS; i++) {
-        bool centerFound = true;
-        for (auto coor : coors_) {
-            if ((coor & (SMALLONE << i)) == 0) {
-                centerFound = false;
-                break;
-            }
-        }
-        if (centerFound) {
-            return NUMBITS - i - 1;
+template <size_t D, class T>
+unsigned Point<D, T>::directions(size_t depth) const {
+    T oneOne = BIGONE >> depth;
+    unsigned directions = 0;
+    for (size_t i = 0; i < D; i++) {
+        if ((coors_[i] & oneOne) == 0) {
+            directions |= 1u << i;
         }
     }
-    return 0;
+    return directions;
 }
 
 #ifdef DEBUG
-std::ostream& cubitos::operator<<(std::ostream& out, const Point& p) {
+template <size_t D, class T>
+std::ostream& cubitos::operator<<(std::ostream& out, const Point<D, T>& p) {
     out << "[";
     auto c = p.coors_.begin();
     out << *c;
@@ -108,3 +144,17 @@ std::ostream& cubitos::operator<<(std::ostream& out, const Point& p) {
     return out;
 }
 #endif  // DEBUG
+
+#ifdef DEBUG
+#define INSTANTIATE_POINT_DEBUG(D, T)                         \
+    template std::ostream& cubitos::operator<<(std::ostream&, \
+                                               const Point<D, T>&);
+#else
+#define INSTANTIATE_POINT_DEBUG(D, T)
+#endif  // DEBUG
+#define INSTANTIATE_POINT(D, T)               \
+    template struct cubitos::Point<D, T>;     \
+    template struct cubitos::PointHash<D, T>; \
+    INSTANTIATE_POINT_DEBUG(D, T)
+#define INSTANTIATE_POINTS(T) FOR_EACH_DIM(INSTANTIATE_POINT, T)
+FOR_EACH_COOR(INSTANTIATE_POINTS)
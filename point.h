@@ -2,7 +2,9 @@
 // file: point.h
 // description: Defines a point in a ([0, 2^NUMBITS))^n discrete space
 
-#include <bitset>
+#include <array>
+#include <cstdint>
+#include <limits>
 #include <ostream>
 #include <vector>
 
@@ -11,36 +13,54 @@
 namespace cubitos {
 
 // Encapsulating points complicates bit operations, so I define them as a
-// struct
+// struct. The dimension is fixed at compile time, so that coordinates are
+// stored inline and loops over them can be unrolled. Coordinates are
+// unsigned integers of type T, its number of bits bounds the depth.
+template <size_t D, class T>
 struct Point {
+    // Bits of a coordinate
+    static const int NUMBITS = std::numeric_limits<T>::digits;
+    // Coordinate with only the most significant bit set
+    static const T BIGONE = T(1) << (NUMBITS - 1);
+
     /* Data */
-    size_t dim_;
-    std::vector<std::bitset<NUMBITS>> coors_;
+    std::array<T, D> coors_;
 
     // Constructors
     Point();
-    Point(std::vector<std::bitset<NUMBITS>> point);
-    Point(std::vector<float> coors);
-
-    // The order relationship gives preference to the first coordinates
-    bool operator<(const Point& rhs) const;
-    bool operator==(const Point& rhs) const;
-    bool operator!=(const Point& rhs) const;
-
-    // Truncates a point to the first n bits
-    Point truncate(size_t n) const;
-
-    bool equalsTruncated(const Point& center, size_t depth) const;
-    // Computes directions and non-directions for the simplex (where the
-    //  simplex can expand and where not).
-    void directions(size_t depth, std::vector<int>& directions,
-                    std::vector<int>& nondirections) const;
-    // Returns the depth of this point as a center in the mesh
-    size_t depthAsCenter() const;
+    Point(const std::array<T, D>& coors);
+    // Pre: coors points to D coordinates in [0, 1]
+    Point(const float* coors);
+
+    bool operator==(const Point<D, T>& rhs) const;
+    bool operator!=(const Point<D, T>& rhs) const;
+
+    // Writes the Morton key of the first <levels> bits of the point in
+    // ceil(dim * levels / 64) words: the bits of its coordinates interleaved
+    // from the most significant ones, the first coordinate first, so that
+    // sorting the keys sorts the points in Morton order.
+    void mortonKey(size_t levels, uint64_t* key) const;
+
+    // Computes the directions of the simplex of depth <depth> centered at
+    // this point (where the simplex extends and where not) as a bitmask with
+    // bit i set if it extends along the i-th coordinate
+    unsigned directions(size_t depth) const;
+};
+
+template <size_t D, class T>
+const int Point<D, T>::NUMBITS;
+template <size_t D, class T>
+const T Point<D, T>::BIGONE;
+
+// Hash of a point for unordered containers
+template <size_t D, class T>
+struct PointHash {
+    size_t operator()(const Point<D, T>& point) const;
 };
 
 #ifdef DEBUG
-std::ostream& operator<<(std::ostream& out, const Point& p);
+template <size_t D, class T>
+std::ostream& operator<<(std::ostream& out, const Point<D, T>& p);
 #endif  // DEBUG
 
 }  // namespace cubitos
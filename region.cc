@@ -1,77 +1,63 @@
 #include "region.h"
 
-using namespace cubitos;
-
-Region::Region() : isDegenerate_(false) {}
+#include <algorithm>
+#include <cassert>
 
-// Pre: begin matches an existing point
-Region::Region(size_t depth, std::vector<Point>::iterator begin,
-               std::vector<Point>::iterator end)
-    : depth_(depth), firstPoint_(begin), isDegenerate_(false) {
-    corner_ = firstPoint_->truncate(depth_);
-    for (endPoint_ = firstPoint_ + 1; endPoint_ != end && contains(*endPoint_);
-         endPoint_++);
-    if (firstPoint_ == (endPoint_ - 1)) {
-        // This region only contains one point, there is no reason to
-        // subdivide any longer.
-        isDegenerate_ = true;
-        degenerateCenter_ = *firstPoint_;
-    }
-}
+using namespace cubitos;
 
-bool Region::contains(const Point& p) const {
-    return p.equalsTruncated(corner_, depth_);
+template <size_t D, class T>
+Region<D, T>::Region()
+    : maxDepth_(0), keyWords_(0), keys_(nullptr), numKeys_(0) {}
+
+template <size_t D, class T>
+Region<D, T>::Region(const SortedKeys& keys, size_t maxDepth)
+    : maxDepth_(maxDepth),
+      keyWords_(keys.keyWords()),
+      keys_(keys.data()),
+      numKeys_(keys.size()) {
+    assert(maxDepth_ <= size_t(Point<D, T>::NUMBITS));
+    assert(keyWords_ == std::max<size_t>(1, (D * maxDepth_ + 63) / 64));
+    assert(numKeys_ > 0);
 }
 
-// Pre: p is in this region
-bool Region::containsInDepth(const Point& p, size_t depth) {
-    if (depth == depth_) {
-        return true;
-    }
-    if (isDegenerate_) {
-        return p.equalsTruncated(degenerateCenter_.truncate(depth), depth);
-    }
-    for (auto x : getSubregions()) {
-        if (x.contains(p)) {
-            return x.containsInDepth(p, depth);
+template <size_t D, class T>
+bool Region<D, T>::equalPrefix(const uint64_t* a, const uint64_t* b,
+                               size_t bits) {
+    for (size_t w = 0; w < bits / 64; w++) {
+        if (a[w] != b[w]) {
+            return false;
         }
     }
-    return false;
-}
-
-std::vector<Region>& Region::getSubregions() {
-    if (subregions_.size() == 0) {
-        subdivide();
-    }
-    return subregions_;
-}
-
-void Region::subdivide() {
-    auto it = firstPoint_;
-    while (it != endPoint_) {
-        auto r = Region(depth_ + 1, it, endPoint_);
-        subregions_.push_back(r);
-        it = r.endPoint_;
-    }
+    return bits % 64 == 0 ||
+           (a[bits / 64] >> (64 - bits % 64)) ==
+               (b[bits / 64] >> (64 - bits % 64));
 }
 
 #ifdef DEBUG
-std::ostream& cubitos::operator<<(std::ostream& out, const Region& r) {
-    std::string tab = "";
-    for (size_t i = 0; i < r.depth_; i++) {
-        tab += "  ";
-    }
-    out << tab << "Region {";
-    for (auto x = r.firstPoint_; x != r.endPoint_ - 1; x++) {
-        out << *x << ", ";
-    }
-    out << *(r.endPoint_ - 1);
-
-    for (auto x : r.subregions_) {
-        out << std::endl << x;
+template <size_t D, class T>
+std::ostream& cubitos::operator<<(std::ostream& out, const Region<D, T>& r) {
+    out << "Region of depth " << r.maxDepth_ << " {";
+    for (size_t k = 0; k < r.numKeys_; k++) {
+        out << std::endl << "  ";
+        for (size_t w = 0; w < r.keyWords_; w++) {
+            out << std::hex << r.keyAt(k)[w] << std::dec << ' ';
+        }
     }
     out << "}";
 
     return out;
 }
 #endif  // DEBUG
+
+#ifdef DEBUG
+#define INSTANTIATE_REGION_DEBUG(D, T)                        \
+    template std::ostream& cubitos::operator<<(std::ostream&, \
+                                               const Region<D, T>&);
+#else
+#define INSTANTIATE_REGION_DEBUG(D, T)
+#endif  // DEBUG
+#define INSTANTIATE_REGION(D, T)          \
+    template class cubitos::Region<D, T>; \
+    INSTANTIATE_REGION_DEBUG(D, T)
+#define INSTANTIATE_REGIONS(T) FOR_EACH_DIM(INSTANTIATE_REGION, T)
+FOR_EACH_COOR(INSTANTIATE_REGIONS)
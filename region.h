@@ -2,48 +2,61 @@
 // file: region.h
 // description: represents a region of the [0, 2^N)^n discrete space.
 
+#include <cstdint>
+
+#include "keys.h"
 #include "point.h"
 
 namespace cubitos {
 
+template <size_t D, class T>
+class OccupancyCache;
+
+// Immutable index of a cloud of points as a linear octree: the sorted Morton
+// keys of the cells of maxDepth with some point. The cell of depth d
+// containing a point is a prefix of its key, so the cells of depth d with
+// some point are the distinct prefixes of the keys. The keys are not copied,
+// they may be in memory or in a file mapped in memory. Queries do not modify
+// it, so a region can be shared among threads.
+template <size_t D, class T>
 class Region {
    public:
     // Constructors
     Region();
-    Region(size_t depth, std::vector<Point>::iterator begin,
-           std::vector<Point>::iterator end);
+    // Indexes the cells with the given keys of maxDepth levels
+    // Pre: keys are not empty and outlive the region, maxDepth <=
+    // Point<D, T>::NUMBITS
+    Region(const SortedKeys& keys, size_t maxDepth);
 
-    // Boolean function used to determine whether there a point is in subregion
-    bool containsInDepth(const Point& p, size_t depth);
+    // Depth down to which the region is indexed
+    size_t maxDepth() const { return maxDepth_; }
+
+    // Reads the cells of a depth straight from the keys
+    friend class OccupancyCache<D, T>;
 
 #ifdef DEBUG
-    friend std::ostream& operator<<(std::ostream& out, const Region& r);
+    template <size_t E, class U>
+    friend std::ostream& operator<<(std::ostream& out, const Region<E, U>& r);
 #endif  // DEBUG
 
    private:
-    inline void subdivide();
-    std::vector<Region>& getSubregions();
-    // Returns whether p is in this region
-    bool contains(const Point& p) const;
-
-    size_t depth_;
-
-    // First and last points contained in this region
-    std::vector<Point>::iterator firstPoint_, endPoint_;
-
-    std::vector<Region> subregions_;
-    // The corner is stored instead of the center to reduce bit shifting
-    // operations
-    Point corner_;
-
-    // Degenerate regions contain only one point and do not subdivide.
-    // Instead, we store the only point they contain.
-    bool isDegenerate_;
-    Point degenerateCenter_;
+    inline const uint64_t* keyAt(size_t i) const {
+        return keys_ + i * keyWords_;
+    }
+
+    // Whether keys a and b have the same first <bits> bits
+    static bool equalPrefix(const uint64_t* a, const uint64_t* b, size_t bits);
+
+    size_t maxDepth_, keyWords_;
+    // Morton keys down to maxDepth_, keyWords_ words each, sorted and
+    // without repetitions
+    const uint64_t* keys_;
+    size_t numKeys_;
 };
 
 #ifdef DEBUG
-std::ostream& operator<<(std::ostream& out, const Region& r);
+template <size_t D, class T>
+std::ostream& operator<<(std::ostream& out, const Region<D, T>& r);
 #endif  // DEBUG
 
 }  // namespace cubitos
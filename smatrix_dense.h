@@ -0,0 +1,343 @@
+#pragma once
+// file: smatrix_dense.h
+// description: Dense SMatrix backend on top of LinBox. Only included through
+//              smatrix.h when DENSE_MATRICES is defined
+
+#include <linbox/linbox-config.h>
+#include <linbox/matrix/transpose-matrix.h>
+#include <linbox/ring/modular.h>
+#include <linbox/solutions/echelon.h>
+#include <linbox/solutions/methods.h>
+#include <linbox/solutions/rank.h>
+
+#include <cstdint>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace cubitos {
+
+typedef Givaro::Modular<double> Field;
+
+// The largest prime Givaro::Modular<double> can work with (its moduli must
+// be below 94906265)
+static const size_t LARGE_PRIME = 94906249;
+
+template <size_t _N>
+class SMatrix {
+   public:
+    typedef Givaro::Modular<double> Field;
+    typedef Field::Element Element;
+    SMatrix() : n_(0), m_(0), matrix_(field_, 0, 0) {}
+    SMatrix(int n, int m) : n_(n), m_(m), matrix_(field_, n, m) {}
+
+    // Returns the identity matrix I_n
+    static SMatrix<_N> identity(size_t n) {
+        SMatrix id(n, n);
+        for (size_t i = 0; i < n; i++) {
+            id.insert(i, i, 1);
+        }
+        return id;
+    }
+
+    // Returns the null matrix
+    static SMatrix<_N> zeroMatrix() { return SMatrix<_N>(0, 0); }
+
+    // Returns lhs * rhs
+    static SMatrix<_N> mul(const SMatrix<_N>& lhs, const SMatrix<_N>& rhs) {
+        if (lhs.isNull() || rhs.isNull()) {
+            return zeroMatrix();
+        }
+        SMatrix<_N> mat(lhs.n_, rhs.m_);
+        SMatrix<_N>::matrixDomain_.mul(mat.matrix_, lhs.matrix_, rhs.matrix_);
+        return mat;
+    }
+
+    // Whether this matrix is the null one
+    bool isNull() const { return (n_ == 0 && m_ == 0); }
+
+    inline size_t rowdim() const { return n_; }
+    inline size_t coldim() const { return m_; }
+
+    inline void insert(int i, int j, const Element& v) {
+        matrix_.setEntry(i, j, v);
+    }
+
+    const inline Element& get(int i, int j) const {
+        return matrix_.getEntry(i, j);
+    }
+
+    static const Field& field() { return field_; }
+
+    // Returns the last row with a nonzero entry in col, or the number of
+    // rows if there is none
+    inline size_t low(size_t col) const {
+        for (size_t i = n_; i > 0; i--) {
+            if (!field_.isZero(get(i - 1, col))) {
+                return i - 1;
+            }
+        }
+        return n_;
+    }
+
+    inline void scaleCol(size_t col, const Element& elm) {
+        for (size_t j = 0; j < n_; j++) {
+            field_.mulin(matrix_.refEntry(j, col), elm);
+        }
+    }
+
+    inline void colCombine(size_t addTo, size_t scaleCol,
+                           const Element& scaleAmt) {
+        for (size_t i = 0; i < n_; i++) {
+            field_.axpyin(matrix_.refEntry(i, addTo),
+                          matrix_.getEntry(i, scaleCol), scaleAmt);
+        }
+    }
+
+    // Adds scaleAmt times column scaleCol of other to addTo
+    inline void colCombine(size_t addTo, const SMatrix<_N>& other,
+                           size_t scaleCol, const Element& scaleAmt) {
+        for (size_t i = 0; i < n_; i++) {
+            field_.axpyin(matrix_.refEntry(i, addTo), other.get(i, scaleCol),
+                          scaleAmt);
+        }
+    }
+
+    inline void rightMulIn(const SMatrix<_N>& rhs) { *this = mul(*this, rhs); }
+
+    inline void leftMulIn(const SMatrix<_N>& lhs) { *this = mul(lhs, *this); }
+
+    // Returns the matrix made of the given columns
+    SMatrix<_N> selectCols(const std::vector<size_t>& cols) const {
+        SMatrix<_N> mat(n_, cols.size());
+        for (size_t j = 0; j < cols.size(); j++) {
+            for (size_t i = 0; i < n_; i++) {
+                mat.insert(i, j, get(i, cols[j]));
+            }
+        }
+        return mat;
+    }
+
+    size_t nullity() {
+        if (isNull()) {
+            return 0;
+        }
+        size_t r;
+        LinBox::rank(r, matrix_);
+        return m_ - r;
+    }
+
+#ifdef DEBUG
+    friend std::ostream& operator<<(std::ostream& out,
+                                    const SMatrix<_N>& smatrix) {
+        if (smatrix.isNull()) {
+            out << "Empty matrix" << std::endl;
+            return out;
+        }
+        for (size_t i = 0; i < smatrix.matrix_.rowdim(); i++) {
+            for (size_t j = 0; j < smatrix.matrix_.coldim(); j++) {
+                out << std::setw(3) << smatrix.get(i, j) << ' ';
+            }
+            out << std::endl;
+        }
+        return out;
+    }
+#endif  // DEBUG
+   private:
+    size_t n_, m_;
+    static const Field field_;
+    static const LinBox::MatrixDomain<Field> matrixDomain_;
+    LinBox::DenseMatrix<Field> matrix_;
+};
+
+template <size_t _N>
+const Field SMatrix<_N>::field_ = Field(_N);
+template <size_t _N>
+const LinBox::MatrixDomain<Field> SMatrix<_N>::matrixDomain_ =
+    LinBox::MatrixDomain<Field>(SMatrix<_N>::field_);
+
+// Z/2 specialization. Every column is packed in 64-bit words, so a column
+// operation is a word-wide xor.
+template <>
+class SMatrix<2> {
+   public:
+    typedef bool Element;
+    SMatrix() : n_(0), m_(0), stride_(0) {}
+    SMatrix(int n, int m)
+        : n_(n), m_(m), stride_((n + 63) / 64), words_(stride_ * m, 0) {}
+
+    // Returns the identity matrix I_n
+    static SMatrix<2> identity(size_t n) {
+        SMatrix id(n, n);
+        for (size_t i = 0; i < n; i++) {
+            id.flip(i, i);
+        }
+        return id;
+    }
+
+    // Returns the null matrix
+    static SMatrix<2> zeroMatrix() { return SMatrix<2>(0, 0); }
+
+    // Returns lhs * rhs
+    static SMatrix<2> mul(const SMatrix<2>& lhs, const SMatrix<2>& rhs) {
+        if (lhs.isNull() || rhs.isNull()) {
+            return zeroMatrix();
+        }
+        SMatrix<2> mat(lhs.n_, rhs.m_);
+        for (size_t j = 0; j < rhs.m_; j++) {
+            const uint64_t* words = rhs.col(j);
+            for (size_t w = 0; w < rhs.stride_; w++) {
+                // Every set bit k of the column adds column k of lhs
+                for (uint64_t word = words[w]; word != 0; word &= word - 1) {
+                    size_t k = w * 64 + __builtin_ctzll(word);
+                    xorWords(mat.col(j), lhs.col(k), mat.stride_);
+                }
+            }
+        }
+        return mat;
+    }
+
+    // Whether this matrix is the null one
+    bool isNull() const { return (n_ == 0 && m_ == 0); }
+
+    inline size_t rowdim() const { return n_; }
+    inline size_t coldim() const { return m_; }
+
+    // Entries are given as integers and reduced mod 2
+    inline void insert(int i, int j, long v) {
+        if (get(i, j) != (v & 1)) {
+            flip(i, j);
+        }
+    }
+
+    inline Element get(int i, int j) const {
+        return (col(j)[i / 64] >> (i % 64)) & 1;
+    }
+
+    // Returns the last row with a nonzero entry in col, or the number of
+    // rows if there is none
+    inline size_t low(size_t col) const {
+        const uint64_t* words = this->col(col);
+        for (size_t w = stride_; w > 0; w--) {
+            if (words[w - 1] != 0) {
+                return (w - 1) * 64 + 63 - __builtin_clzll(words[w - 1]);
+            }
+        }
+        return n_;
+    }
+
+    inline void scaleCol(size_t col, const Element& elm) {
+        if (!elm) {
+            std::fill(this->col(col), this->col(col) + stride_, 0);
+        }
+    }
+
+    inline void colCombine(size_t addTo, size_t scaleCol,
+                           const Element& scaleAmt) {
+        if (scaleAmt) {
+            xorWords(col(addTo), col(scaleCol), stride_);
+        }
+    }
+
+    // Adds scaleAmt times column scaleCol of other to addTo
+    inline void colCombine(size_t addTo, const SMatrix<2>& other,
+                           size_t scaleCol, const Element& scaleAmt) {
+        if (scaleAmt) {
+            xorWords(col(addTo), other.col(scaleCol), stride_);
+        }
+    }
+
+    inline void rightMulIn(const SMatrix<2>& rhs) { *this = mul(*this, rhs); }
+
+    inline void leftMulIn(const SMatrix<2>& lhs) { *this = mul(lhs, *this); }
+
+    // Returns the matrix made of the given columns
+    SMatrix<2> selectCols(const std::vector<size_t>& cols) const {
+        SMatrix<2> mat(n_, cols.size());
+        for (size_t j = 0; j < cols.size(); j++) {
+            std::copy(col(cols[j]), col(cols[j]) + stride_, mat.col(j));
+        }
+        return mat;
+    }
+
+    size_t nullity() {
+        if (isNull()) {
+            return 0;
+        }
+        return m_ - eliminate();
+    }
+
+#ifdef DEBUG
+    friend std::ostream& operator<<(std::ostream& out,
+                                    const SMatrix<2>& smatrix) {
+        if (smatrix.isNull()) {
+            out << "Empty matrix" << std::endl;
+            return out;
+        }
+        for (size_t i = 0; i < smatrix.n_; i++) {
+            for (size_t j = 0; j < smatrix.m_; j++) {
+                out << std::setw(3) << smatrix.get(i, j) << ' ';
+            }
+            out << std::endl;
+        }
+        return out;
+    }
+#endif  // DEBUG
+   private:
+    inline uint64_t* col(size_t j) { return words_.data() + j * stride_; }
+    inline const uint64_t* col(size_t j) const {
+        return words_.data() + j * stride_;
+    }
+
+    inline void flip(size_t i, size_t j) {
+        col(j)[i / 64] ^= 1ULL << (i % 64);
+    }
+
+    // dst ^= src over n words
+    static inline void xorWords(uint64_t* dst, const uint64_t* src,
+                                size_t n) {
+        size_t w = 0;
+#ifdef __AVX2__
+        for (; w + 4 <= n; w += 4) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(dst + w));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(src + w));
+            _mm256_storeu_si256((__m256i*)(dst + w), _mm256_xor_si256(a, b));
+        }
+#endif  // __AVX2__
+        for (; w < n; w++) {
+            dst[w] ^= src[w];
+        }
+    }
+
+    // Column echelonizes a copy of the matrix and returns its rank
+    size_t eliminate() const {
+        std::vector<uint64_t> words = words_;
+        std::vector<size_t> pivotCol(n_, m_);
+        size_t r = 0;
+        for (size_t j = 0; j < m_; j++) {
+            uint64_t* col = words.data() + j * stride_;
+            for (size_t w = 0; w < stride_;) {
+                if (col[w] == 0) {
+                    w++;
+                    continue;
+                }
+                size_t low = w * 64 + __builtin_ctzll(col[w]);
+                if (pivotCol[low] == m_) {
+                    pivotCol[low] = j;
+                    r++;
+                    break;
+                }
+                xorWords(col, words.data() + pivotCol[low] * stride_,
+                         stride_);
+            }
+        }
+        return r;
+    }
+
+    size_t n_, m_, stride_;
+    std::vector<uint64_t> words_;
+};
+
+}  // namespace cubitos
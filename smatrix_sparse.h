@@ -0,0 +1,449 @@
+#pragma once
+// file: smatrix_sparse.h
+// description: Sparse SMatrix backend. Each column is stored as a list of
+//              (row, value) entries sorted by row. Only included through
+//              smatrix.h
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+#include "zpfield.h"
+
+namespace cubitos {
+
+// The largest prime below 2^32, so that ZpField products fit in 64 bits
+static const size_t LARGE_PRIME = 4294967291;
+
+template <size_t _N>
+class SMatrix {
+   public:
+    typedef ZpField<_N> Field;
+    typedef typename Field::Element Element;
+    SMatrix() : n_(0), m_(0) {}
+    SMatrix(int n, int m) : n_(n), m_(m), cols_(m) {
+        // Row indices are stored in 32 bits
+        assert(n_ <= std::numeric_limits<uint32_t>::max());
+    }
+
+    // Returns the identity matrix I_n
+    static SMatrix<_N> identity(size_t n) {
+        SMatrix id(n, n);
+        for (size_t i = 0; i < n; i++) {
+            id.cols_[i].push_back({(uint32_t)i, 1});
+        }
+        return id;
+    }
+
+    // Returns the null matrix
+    static SMatrix<_N> zeroMatrix() { return SMatrix<_N>(0, 0); }
+
+    // Returns lhs * rhs
+    static SMatrix<_N> mul(const SMatrix<_N>& lhs, const SMatrix<_N>& rhs) {
+        if (lhs.isNull() || rhs.isNull()) {
+            return zeroMatrix();
+        }
+        SMatrix<_N> mat(lhs.n_, rhs.m_);
+        // Each column of the product is accumulated densely and then
+        // gathered, only the touched rows are visited. Products are summed
+        // unreduced and only reduced every LAZY_TERMS columns of lhs.
+        typedef typename Field::Wide Wide;
+        std::vector<Wide> acc(lhs.n_, 0);
+        std::vector<bool> touched(lhs.n_, false);
+        std::vector<uint32_t> rows;
+        for (size_t j = 0; j < rhs.m_; j++) {
+            Wide terms = 0;
+            for (const auto& r : rhs.cols_[j]) {
+                if (++terms > Field::LAZY_TERMS) {
+                    for (auto row : rows) {
+                        acc[row] = Field::reduce(acc[row]);
+                    }
+                    terms = 1;
+                }
+                for (const auto& l : lhs.cols_[r.row]) {
+                    acc[l.row] += (Wide)l.value * r.value;
+                    if (!touched[l.row]) {
+                        touched[l.row] = true;
+                        rows.push_back(l.row);
+                    }
+                }
+            }
+            std::sort(rows.begin(), rows.end());
+            for (auto row : rows) {
+                Element value = Field::reduce(acc[row]);
+                if (!field_.isZero(value)) {
+                    mat.cols_[j].push_back({row, value});
+                }
+                acc[row] = 0;
+                touched[row] = false;
+            }
+            rows.clear();
+        }
+        return mat;
+    }
+
+    // Whether this matrix is the null one
+    bool isNull() const { return (n_ == 0 && m_ == 0); }
+
+    inline size_t rowdim() const { return n_; }
+    inline size_t coldim() const { return m_; }
+
+    // Entries are given as integers and reduced mod _N
+    inline void insert(int i, int j, long v) {
+        Element elem;
+        field_.init(elem, v);
+        auto& col = cols_[j];
+        auto it = find(col, i);
+        if (it != col.end() && it->row == (uint32_t)i) {
+            if (field_.isZero(elem)) {
+                col.erase(it);
+            } else {
+                it->value = elem;
+            }
+        } else if (!field_.isZero(elem)) {
+            col.insert(it, {(uint32_t)i, elem});
+        }
+    }
+
+    inline Element get(int i, int j) const {
+        const auto& col = cols_[j];
+        auto it = find(col, i);
+        if (it != col.end() && it->row == (uint32_t)i) {
+            return it->value;
+        }
+        return 0;
+    }
+
+    static const Field& field() { return field_; }
+
+    // Returns the last row with a nonzero entry in col, or the number of
+    // rows if there is none
+    inline size_t low(size_t col) const {
+        return cols_[col].empty() ? n_ : cols_[col].back().row;
+    }
+
+    inline void scaleCol(size_t col, const Element& elm) {
+        if (field_.isZero(elm)) {
+            cols_[col].clear();
+        }
+        for (auto& entry : cols_[col]) {
+            field_.mulin(entry.value, elm);
+        }
+    }
+
+    inline void colCombine(size_t addTo, size_t scaleCol,
+                           const Element& scaleAmt) {
+        axpyColumn(cols_[addTo], cols_[scaleCol], scaleAmt);
+    }
+
+    // Adds scaleAmt times column scaleCol of other to addTo
+    inline void colCombine(size_t addTo, const SMatrix<_N>& other,
+                           size_t scaleCol, const Element& scaleAmt) {
+        axpyColumn(cols_[addTo], other.cols_[scaleCol], scaleAmt);
+    }
+
+    inline void rightMulIn(const SMatrix<_N>& rhs) { *this = mul(*this, rhs); }
+
+    inline void leftMulIn(const SMatrix<_N>& lhs) { *this = mul(lhs, *this); }
+
+    // Returns the matrix made of the given columns
+    SMatrix<_N> selectCols(const std::vector<size_t>& cols) const {
+        SMatrix<_N> mat(n_, cols.size());
+        for (size_t j = 0; j < cols.size(); j++) {
+            mat.cols_[j] = cols_[cols[j]];
+        }
+        return mat;
+    }
+
+    size_t nullity() {
+        if (isNull()) {
+            return 0;
+        }
+        return m_ - eliminate();
+    }
+
+#ifdef DEBUG
+    friend std::ostream& operator<<(std::ostream& out,
+                                    const SMatrix<_N>& smatrix) {
+        if (smatrix.isNull()) {
+            out << "Empty matrix" << std::endl;
+            return out;
+        }
+        for (size_t i = 0; i < smatrix.n_; i++) {
+            for (size_t j = 0; j < smatrix.m_; j++) {
+                out << std::setw(3) << (long)smatrix.get(i, j) << ' ';
+            }
+            out << std::endl;
+        }
+        return out;
+    }
+#endif  // DEBUG
+   private:
+    struct Entry {
+        uint32_t row;
+        Element value;
+    };
+    typedef std::vector<Entry> Column;
+
+    // Returns the first entry of col whose row is >= row
+    static typename Column::iterator find(Column& col, size_t row) {
+        return std::lower_bound(
+            col.begin(), col.end(), row,
+            [](const Entry& e, size_t r) { return e.row < r; });
+    }
+    static typename Column::const_iterator find(const Column& col,
+                                                size_t row) {
+        return std::lower_bound(
+            col.begin(), col.end(), row,
+            [](const Entry& e, size_t r) { return e.row < r; });
+    }
+
+    // dst += a * src, merging both sorted columns
+    static void axpyColumn(Column& dst, const Column& src, const Element& a) {
+        if (src.empty()) {
+            return;
+        }
+        Column merged;
+        merged.reserve(dst.size() + src.size());
+        auto d = dst.begin();
+        auto s = src.begin();
+        while (d != dst.end() || s != src.end()) {
+            if (s == src.end() || (d != dst.end() && d->row < s->row)) {
+                merged.push_back(*d++);
+            } else {
+                Entry entry = {s->row, 0};
+                if (d != dst.end() && d->row == s->row) {
+                    entry.value = (d++)->value;
+                }
+                field_.axpyin(entry.value, s->value, a);
+                if (!field_.isZero(entry.value)) {
+                    merged.push_back(entry);
+                }
+                s++;
+            }
+        }
+        dst.swap(merged);
+    }
+
+    // Column echelonizes a copy of the matrix and returns its rank. Every
+    // column is reduced until its last row is not the last row of a
+    // previous column.
+    size_t eliminate() const {
+        std::vector<Column> cols = cols_;
+        std::vector<size_t> pivotCol(n_, m_);
+        size_t r = 0;
+        for (size_t j = 0; j < m_; j++) {
+            Column& col = cols[j];
+            while (!col.empty() && pivotCol[col.back().row] != m_) {
+                const Column& pivot = cols[pivotCol[col.back().row]];
+                Element c = pivot.back().value;
+                field_.invin(c);
+                field_.mulin(c, col.back().value);
+                field_.negin(c);
+                axpyColumn(col, pivot, c);
+            }
+            if (!col.empty()) {
+                pivotCol[col.back().row] = j;
+                r++;
+            }
+        }
+        return r;
+    }
+
+    size_t n_, m_;
+    static const Field field_;
+    std::vector<Column> cols_;
+};
+
+template <size_t _N>
+const typename SMatrix<_N>::Field SMatrix<_N>::field_ = Field();
+
+// Z/2 specialization. Every nonzero entry is 1, so a column is just the
+// sorted list of its nonzero rows and adding two columns is their symmetric
+// difference.
+template <>
+class SMatrix<2> {
+   public:
+    typedef bool Element;
+    SMatrix() : n_(0), m_(0) {}
+    SMatrix(int n, int m) : n_(n), m_(m), cols_(m) {
+        // Row indices are stored in 32 bits
+        assert(n_ <= std::numeric_limits<uint32_t>::max());
+    }
+
+    // Returns the identity matrix I_n
+    static SMatrix<2> identity(size_t n) {
+        SMatrix id(n, n);
+        for (size_t i = 0; i < n; i++) {
+            id.cols_[i].push_back(i);
+        }
+        return id;
+    }
+
+    // Returns the null matrix
+    static SMatrix<2> zeroMatrix() { return SMatrix<2>(0, 0); }
+
+    // Returns lhs * rhs
+    static SMatrix<2> mul(const SMatrix<2>& lhs, const SMatrix<2>& rhs) {
+        if (lhs.isNull() || rhs.isNull()) {
+            return zeroMatrix();
+        }
+        SMatrix<2> mat(lhs.n_, rhs.m_);
+        // Each column of the product is accumulated as a parity bitmap
+        std::vector<bool> acc(lhs.n_, false);
+        std::vector<uint32_t> rows;
+        for (size_t j = 0; j < rhs.m_; j++) {
+            for (auto k : rhs.cols_[j]) {
+                for (auto i : lhs.cols_[k]) {
+                    if (!acc[i]) {
+                        rows.push_back(i);
+                    }
+                    acc[i] = !acc[i];
+                }
+            }
+            std::sort(rows.begin(), rows.end());
+            rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+            for (auto i : rows) {
+                if (acc[i]) {
+                    mat.cols_[j].push_back(i);
+                }
+                acc[i] = false;
+            }
+            rows.clear();
+        }
+        return mat;
+    }
+
+    // Whether this matrix is the null one
+    bool isNull() const { return (n_ == 0 && m_ == 0); }
+
+    inline size_t rowdim() const { return n_; }
+    inline size_t coldim() const { return m_; }
+
+    // Entries are given as integers and reduced mod 2
+    inline void insert(int i, int j, long v) {
+        if (get(i, j) != (v & 1)) {
+            flip(i, j);
+        }
+    }
+
+    inline Element get(int i, int j) const {
+        return std::binary_search(cols_[j].begin(), cols_[j].end(),
+                                  (uint32_t)i);
+    }
+
+    // Returns the last row with a nonzero entry in col, or the number of
+    // rows if there is none
+    inline size_t low(size_t col) const {
+        return cols_[col].empty() ? n_ : cols_[col].back();
+    }
+
+    inline void scaleCol(size_t col, const Element& elm) {
+        if (!elm) {
+            cols_[col].clear();
+        }
+    }
+
+    inline void colCombine(size_t addTo, size_t scaleCol,
+                           const Element& scaleAmt) {
+        if (scaleAmt) {
+            xorColumn(cols_[addTo], cols_[scaleCol]);
+        }
+    }
+
+    // Adds scaleAmt times column scaleCol of other to addTo
+    inline void colCombine(size_t addTo, const SMatrix<2>& other,
+                           size_t scaleCol, const Element& scaleAmt) {
+        if (scaleAmt) {
+            xorColumn(cols_[addTo], other.cols_[scaleCol]);
+        }
+    }
+
+    inline void rightMulIn(const SMatrix<2>& rhs) { *this = mul(*this, rhs); }
+
+    inline void leftMulIn(const SMatrix<2>& lhs) { *this = mul(lhs, *this); }
+
+    // Returns the matrix made of the given columns
+    SMatrix<2> selectCols(const std::vector<size_t>& cols) const {
+        SMatrix<2> mat(n_, cols.size());
+        for (size_t j = 0; j < cols.size(); j++) {
+            mat.cols_[j] = cols_[cols[j]];
+        }
+        return mat;
+    }
+
+    size_t nullity() {
+        if (isNull()) {
+            return 0;
+        }
+        return m_ - eliminate();
+    }
+
+#ifdef DEBUG
+    friend std::ostream& operator<<(std::ostream& out,
+                                    const SMatrix<2>& smatrix) {
+        if (smatrix.isNull()) {
+            out << "Empty matrix" << std::endl;
+            return out;
+        }
+        for (size_t i = 0; i < smatrix.n_; i++) {
+            for (size_t j = 0; j < smatrix.m_; j++) {
+                out << std::setw(3) << smatrix.get(i, j) << ' ';
+            }
+            out << std::endl;
+        }
+        return out;
+    }
+#endif  // DEBUG
+   private:
+    typedef std::vector<uint32_t> Column;
+
+    inline void flip(size_t i, size_t j) {
+        auto& col = cols_[j];
+        auto it = std::lower_bound(col.begin(), col.end(), (uint32_t)i);
+        if (it != col.end() && *it == i) {
+            col.erase(it);
+        } else {
+            col.insert(it, i);
+        }
+    }
+
+    // dst ^= src, i.e. the symmetric difference of both sorted columns
+    static void xorColumn(Column& dst, const Column& src) {
+        if (src.empty()) {
+            return;
+        }
+        Column merged;
+        merged.reserve(dst.size() + src.size());
+        std::set_symmetric_difference(dst.begin(), dst.end(), src.begin(),
+                                      src.end(), std::back_inserter(merged));
+        dst.swap(merged);
+    }
+
+    // Column echelonizes a copy of the matrix and returns its rank
+    size_t eliminate() const {
+        std::vector<Column> cols = cols_;
+        std::vector<size_t> pivotCol(n_, m_);
+        size_t r = 0;
+        for (size_t j = 0; j < m_; j++) {
+            Column& col = cols[j];
+            while (!col.empty() && pivotCol[col.back()] != m_) {
+                xorColumn(col, cols[pivotCol[col.back()]]);
+            }
+            if (!col.empty()) {
+                pivotCol[col.back()] = j;
+                r++;
+            }
+        }
+        return r;
+    }
+
+    size_t n_, m_;
+    std::vector<Column> cols_;
+};
+
+}  // namespace cubitos
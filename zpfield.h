@@ -0,0 +1,112 @@
+#pragma once
+// file: zpfield.h
+// description: The prime field Z/_N with native unsigned integer elements,
+//              used by the sparse SMatrix backend
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace cubitos {
+
+template <size_t _N>
+class ZpField {
+    static_assert(_N > 1 && _N <= UINT32_MAX, "_N must be a 32-bit prime");
+
+   public:
+    // The smallest unsigned type holding [0, _N)
+    typedef typename std::conditional<
+        (_N <= UINT8_MAX + 1), uint8_t,
+        typename std::conditional<(_N <= UINT16_MAX + 1), uint16_t,
+                                  uint32_t>::type>::type Element;
+
+    // Products are accumulated unreduced in a Wide, LAZY_TERMS of them fit
+    // before it has to be reduced
+    typedef uint64_t Wide;
+    static constexpr Wide LAZY_TERMS =
+        UINT64_MAX / ((Wide)(_N - 1) * (_N - 1));
+
+    // Returns x mod _N using Barrett reduction
+    static inline Element reduce(Wide x) {
+        Wide q = (Wide)(((unsigned __int128)x * BARRETT) >> 64);
+        Wide r = x - q * _N;
+        return (r >= _N) ? r - _N : r;
+    }
+
+    inline Element& init(Element& r, long v) const {
+        long m = v % (long)_N;
+        r = (m < 0) ? m + _N : m;
+        return r;
+    }
+
+    inline bool isZero(const Element& a) const { return a == 0; }
+
+    inline Element& addin(Element& r, const Element& a) const {
+        Wide s = (Wide)r + a;
+        r = (s >= _N) ? s - _N : s;
+        return r;
+    }
+
+    inline Element& subin(Element& r, const Element& a) const {
+        r = (r >= a) ? r - a : (Wide)r + _N - a;
+        return r;
+    }
+
+    inline Element& negin(Element& r) const {
+        r = (r == 0) ? 0 : _N - r;
+        return r;
+    }
+
+    inline Element& mulin(Element& r, const Element& a) const {
+        r = reduce((Wide)r * a);
+        return r;
+    }
+
+    // r += a * x
+    inline Element& axpyin(Element& r, const Element& a,
+                           const Element& x) const {
+        r = reduce((Wide)a * x + r);
+        return r;
+    }
+
+    // Pre: r != 0
+    inline Element& invin(Element& r) const {
+        if (_N <= INVERSE_TABLE_SIZE) {
+            r = inverses()[r];
+            return r;
+        }
+        // Extended Euclid
+        int64_t a = r, b = _N, x0 = 1, x1 = 0;
+        while (b != 0) {
+            int64_t q = a / b, t = b;
+            b = a - q * b;
+            a = t;
+            t = x1;
+            x1 = x0 - q * x1;
+            x0 = t;
+        }
+        r = (x0 < 0) ? x0 + (int64_t)_N : x0;
+        return r;
+    }
+
+   private:
+    static constexpr Wide BARRETT = UINT64_MAX / _N;
+    // Primes below this bound invert through a precomputed table
+    static constexpr size_t INVERSE_TABLE_SIZE = 1 << 16;
+
+    // inv(i) = -(_N / i) * inv(_N mod i), computed once
+    static const std::vector<Element>& inverses() {
+        static const std::vector<Element> table = []() {
+            std::vector<Element> inv(_N <= INVERSE_TABLE_SIZE ? _N : 2, 0);
+            inv[1] = 1;
+            for (size_t i = 2; i < inv.size(); i++) {
+                inv[i] = _N - reduce((Wide)(_N / i) * inv[_N % i]);
+            }
+            return inv;
+        }();
+        return table;
+    }
+};
+
+}  // namespace cubitos